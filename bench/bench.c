@@ -0,0 +1,419 @@
+// Parser and filetool benchmarks. Writes one JSON document to stdout.
+//
+//     clic-bench [path/to/filetool]
+//
+// Without a filetool binary only the parser benchmarks run.
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define CLI_IMPLEMENTATION
+#include "../cli.h"
+
+#define BENCH_MIN_NS 50000000ull  // Run every parser benchmark for at least this long
+#define BENCH_BATCH 16            // Invocations between clock reads
+#define BENCH_TOOL_RUNS 5         // External tools report the best of this many runs
+#define BENCH_OPTS_PER_CMD 4
+#define BENCH_LONG_ARGS 32  // Option/value pairs in the long argv
+
+extern char** environ;
+
+static const u32 bench_sizes[] = {10, 100, 1000, 10000};
+
+/*********************************************************************/
+/* Allocation counting                                               */
+/*********************************************************************/
+
+// Every allocation in this process goes through these, clic's included
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+static bool alloc_counting;
+static u64 alloc_count;
+static u64 alloc_bytes;
+
+void* malloc(size_t size) {
+    if (alloc_counting) {
+        alloc_count++;
+        alloc_bytes += size;
+    }
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    if (alloc_counting) {
+        alloc_count++;
+        alloc_bytes += count * size;
+    }
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    if (alloc_counting) {
+        alloc_count++;
+        alloc_bytes += size;
+    }
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) {
+    __libc_free(ptr);
+}
+
+/*********************************************************************/
+/* Output                                                            */
+/*********************************************************************/
+
+typedef struct {
+    u64 iterations;
+    double ns_per_op;
+    double allocs_per_op;
+    double bytes_per_op;
+} bench_stats;
+
+static bool json_first = true;
+
+static u64 now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+static void json_begin(const char* name) {
+    printf("%s\n    {\"name\": \"%s\"", json_first ? "" : ",", name);
+    json_first = false;
+}
+
+static void json_parser_result(const char* name, const char* shape, u32 size, bench_stats stats) {
+    json_begin(name);
+    printf(", \"shape\": \"%s\", \"size\": %u, \"iterations\": %lu", shape, size, stats.iterations);
+    printf(", \"ns_per_op\": %.1f, \"allocs_per_op\": %.2f, \"bytes_per_op\": %.1f}",
+           stats.ns_per_op,
+           stats.allocs_per_op,
+           stats.bytes_per_op);
+}
+
+static void json_tool_result(const char* name, const char* tool, double ms) {
+    json_begin(name);
+    printf(", \"tool\": \"%s\", \"ms\": %.3f}", tool, ms);
+}
+
+/*********************************************************************/
+/* Parser benchmarks                                                 */
+/*********************************************************************/
+
+typedef enum {
+    BENCH_COMMANDS,  // `size` commands with BENCH_OPTS_PER_CMD options each
+    BENCH_OPTIONS,   // One command with `size` options
+    BENCH_LAZY,      // As BENCH_COMMANDS, registered with cli_app_add_command_lazy()
+} bench_shape;
+
+static const char* const bench_shape_names[] = {"commands", "options", "lazy_commands"};
+
+// Names are referenced by the app, so they live until the app is destroyed
+typedef struct {
+    cli_app* app;
+    char* names;
+    char** cmd_names;  // Primary command names, for building argv
+    char** opt_names;  // Long option names of the last command
+    u32 opt_name_count;
+} bench_app;
+
+static i32 bench_action(cli_option** opts, u32 opt_count) {
+    (void)opts;
+    (void)opt_count;
+    return 0;
+}
+
+static char* bench_name(char** cursor, const char* fmt, u32 index) {
+    char* name = *cursor;
+    *cursor += sprintf(name, fmt, index, index) + 1;
+    return name;
+}
+
+// Option names shared by every lazy command, since a setup callback isn't handed any of its own
+static char bench_lazy_names[BENCH_OPTS_PER_CMD][48];
+
+static void bench_lazy_setup(cli_app* app, cli_command* cmd) {
+    cmd->action = bench_action;
+    for (u32 o = 0; o < BENCH_OPTS_PER_CMD; o++) {
+        cli_cmd_add_option(app, cmd, bench_lazy_names[o], false, false, "A synthetic option");
+    }
+}
+
+static bench_app bench_app_create(bench_shape shape, u32 size) {
+    u32 cmd_count = shape != BENCH_OPTIONS ? size : 1;
+    u32 opt_count = shape != BENCH_OPTIONS ? BENCH_OPTS_PER_CMD : size;
+
+    bench_app b;
+    b.names          = (char*)malloc((size_t)(cmd_count * 2 + cmd_count * opt_count) * 48);
+    b.cmd_names      = (char**)malloc(sizeof(char*) * cmd_count);
+    b.opt_names      = (char**)malloc(sizeof(char*) * opt_count);
+    b.opt_name_count = opt_count;
+    b.app            = cli_app_create("bench", "1.0.0", "Synthetic benchmark app", NULL);
+
+    char* cursor = b.names;
+    for (u32 c = 0; c < cmd_count; c++) {
+        char* names    = bench_name(&cursor, "command-%u, c%u", c);
+        b.cmd_names[c] = bench_name(&cursor, "command-%u", c);
+        if (shape == BENCH_LAZY) {
+            cli_app_add_command_lazy(b.app, names, bench_lazy_setup, "A synthetic command");
+            continue;
+        }
+
+        cli_command* cmd = cli_app_add_command(b.app, names, bench_action, "A synthetic command");
+
+        for (u32 o = 0; o < opt_count; o++) {
+            char* opt = bench_name(&cursor, "-o%u, --option-%u", o);
+            cli_cmd_add_option(b.app, cmd, opt, false, false, "A synthetic option");
+            if (c == cmd_count - 1)
+                b.opt_names[o] = strstr(opt, "--");
+        }
+    }
+    for (u32 o = 0; shape == BENCH_LAZY && o < opt_count; o++) {
+        b.opt_names[o] = strstr(bench_lazy_names[o], "--");
+    }
+
+    cli_app_freeze(b.app);
+    return b;
+}
+
+static void bench_app_destroy(bench_app* b) {
+    cli_app_destroy(b->app);
+    free(b->names);
+    free(b->cmd_names);
+    free(b->opt_names);
+}
+
+static bench_stats bench_create(bench_shape shape, u32 size) {
+    bench_stats stats = {0};
+    u64 elapsed       = 0;
+
+    alloc_count = alloc_bytes = 0;
+    while (elapsed < BENCH_MIN_NS) {
+        alloc_counting = true;
+        u64 start      = now_ns();
+        bench_app b    = bench_app_create(shape, size);
+        elapsed += now_ns() - start;
+        alloc_counting = false;
+
+        bench_app_destroy(&b);
+        stats.iterations++;
+    }
+
+    stats.ns_per_op     = (double)elapsed / (double)stats.iterations;
+    stats.allocs_per_op = (double)alloc_count / (double)stats.iterations;
+    stats.bytes_per_op  = (double)alloc_bytes / (double)stats.iterations;
+    return stats;
+}
+
+static bench_stats bench_run(cli_app* app, int argc, char** argv) {
+    bench_stats stats = {0};
+
+    // The first run creates the thread arena
+    cli_app_run(app, argc, argv);
+
+    alloc_count = alloc_bytes = 0;
+    alloc_counting            = true;
+    u64 start = now_ns(), elapsed = 0;
+    while (elapsed < BENCH_MIN_NS) {
+        for (u32 i = 0; i < BENCH_BATCH; i++) {
+            cli_app_run(app, argc, argv);
+        }
+        stats.iterations += BENCH_BATCH;
+        elapsed = now_ns() - start;
+    }
+    alloc_counting = false;
+
+    stats.ns_per_op     = (double)elapsed / (double)stats.iterations;
+    stats.allocs_per_op = (double)alloc_count / (double)stats.iterations;
+    stats.bytes_per_op  = (double)alloc_bytes / (double)stats.iterations;
+    return stats;
+}
+
+static void bench_parser(bench_shape shape, u32 size) {
+    const char* shape_name = bench_shape_names[shape];
+    json_parser_result("create", shape_name, size, bench_create(shape, size));
+
+    bench_app b  = bench_app_create(shape, size);
+    u32 last_cmd = shape != BENCH_OPTIONS ? size - 1 : 0;
+    char* argv[2 + BENCH_LONG_ARGS * 2];
+    argv[0] = "bench";
+    argv[1] = b.cmd_names[last_cmd];
+
+    // Short: one option. Long: BENCH_LONG_ARGS options, cycling through the command's options.
+    argv[2] = b.opt_names[b.opt_name_count - 1];
+    argv[3] = "value";
+    json_parser_result("run_short", shape_name, size, bench_run(b.app, 4, argv));
+
+    for (u32 i = 0; i < BENCH_LONG_ARGS; i++) {
+        argv[2 + i * 2]     = b.opt_names[(b.opt_name_count - 1 - i) % b.opt_name_count];
+        argv[2 + i * 2 + 1] = "value";
+    }
+    json_parser_result("run_long", shape_name, size, bench_run(b.app, 2 + BENCH_LONG_ARGS * 2, argv));
+
+    // Error paths print diagnostics and help, which is part of their cost. Discard it instead of mixing it into the
+    // results.
+    fflush(stdout);
+    fflush(stderr);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int saved_stderr = dup(STDERR_FILENO);
+    int null_fd      = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(null_fd, STDERR_FILENO);
+
+    argv[2]                     = "--no-such-option-with-a-long-name";
+    bench_stats unknown_option  = bench_run(b.app, 3, argv);
+    argv[1]                     = "no-such-command";
+    bench_stats unknown_command = bench_run(b.app, 2, argv);
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_stdout, STDOUT_FILENO);
+    dup2(saved_stderr, STDERR_FILENO);
+    close(saved_stdout);
+    close(saved_stderr);
+    close(null_fd);
+    json_parser_result("unknown_option", shape_name, size, unknown_option);
+    json_parser_result("unknown_command", shape_name, size, unknown_command);
+
+    bench_app_destroy(&b);
+}
+
+/*********************************************************************/
+/* Tool benchmarks                                                   */
+/*********************************************************************/
+
+#define BENCH_BIG_FILE_SIZE ((size_t)64 << 20)
+#define BENCH_SMALL_FILES 2000
+
+// Wall time of the fastest of BENCH_TOOL_RUNS runs, with output discarded
+static double bench_spawn(char** argv) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    u64 best = UINT64_MAX;
+    for (u32 run = 0; run < BENCH_TOOL_RUNS; run++) {
+        pid_t pid;
+        int status;
+        u64 start = now_ns();
+        if (posix_spawnp(&pid, argv[0], &actions, NULL, argv, environ) != 0 || waitpid(pid, &status, 0) < 0) {
+            best = 0;
+            break;
+        }
+        u64 elapsed = now_ns() - start;
+        best        = elapsed < best ? elapsed : best;
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+    return (double)best / 1e6;
+}
+
+// Random lowercase words of 1-10 letters, roughly 12 per line
+static void bench_write_text(FILE* out, size_t size, u64* seed) {
+    for (size_t written = 0; written < size;) {
+        *seed ^= *seed << 13;
+        *seed ^= *seed >> 7;
+        *seed ^= *seed << 17;
+
+        u32 len = 1 + (u32)(*seed % 10);
+        for (u32 i = 0; i < len; i++) {
+            fputc('a' + (int)((*seed >> (i * 5)) % 26), out);
+        }
+        fputc(*seed % 12 == 0 ? '\n' : ' ', out);
+        written += len + 1;
+    }
+}
+
+static void bench_tools(const char* filetool) {
+    char dir[] = "/tmp/clic-bench.XXXXXX";
+    if (mkdtemp(dir) == NULL)
+        cli_panic("error: failed to create a temporary directory");
+
+    u64 seed = 0x9e3779b97f4a7c15ull;
+    char big[64], small_dir[64];
+    snprintf(big, sizeof(big), "%s/big.txt", dir);
+    snprintf(small_dir, sizeof(small_dir), "%s/small", dir);
+
+    FILE* out = fopen(big, "w");
+    if (out == NULL)
+        cli_panic("error: failed to create '%s'", big);
+    bench_write_text(out, BENCH_BIG_FILE_SIZE, &seed);
+    fclose(out);
+
+    mkdir(small_dir, 0755);
+    char** paths = (char**)malloc(sizeof(char*) * BENCH_SMALL_FILES);
+    for (u32 i = 0; i < BENCH_SMALL_FILES; i++) {
+        paths[i] = (char*)malloc(96);
+        snprintf(paths[i], 96, "%s/%05u.txt", small_dir, i);
+        if ((out = fopen(paths[i], "w")) == NULL)
+            cli_panic("error: failed to create '%s'", paths[i]);
+        bench_write_text(out, 1024, &seed);
+        fclose(out);
+    }
+
+    // count: one large file
+    char* count_big[] = {(char*)filetool, "count", "-p", big, NULL};
+    char* wc_big[]    = {"wc", big, NULL};
+    json_tool_result("count_large", "filetool", bench_spawn(count_big));
+    json_tool_result("count_large", "wc", bench_spawn(wc_big));
+
+    // count and info: many small files. filetool gets "-p <path>" per file, the reference tools the bare paths.
+    char** tool_argv = (char**)malloc(sizeof(char*) * (BENCH_SMALL_FILES * 2 + 4));
+    char** ref_argv  = (char**)malloc(sizeof(char*) * (BENCH_SMALL_FILES + 2));
+    for (u32 i = 0; i < BENCH_SMALL_FILES; i++) {
+        tool_argv[2 + i * 2]     = "-p";
+        tool_argv[2 + i * 2 + 1] = paths[i];
+        ref_argv[1 + i]          = paths[i];
+    }
+    tool_argv[0]                         = (char*)filetool;
+    tool_argv[2 + BENCH_SMALL_FILES * 2] = NULL;
+    ref_argv[1 + BENCH_SMALL_FILES]      = NULL;
+
+    tool_argv[1] = "count";
+    ref_argv[0]  = "wc";
+    json_tool_result("count_many", "filetool", bench_spawn(tool_argv));
+    json_tool_result("count_many", "wc", bench_spawn(ref_argv));
+
+    tool_argv[1] = "info";
+    ref_argv[0]  = "stat";
+    json_tool_result("info_many", "filetool", bench_spawn(tool_argv));
+    json_tool_result("info_many", "stat", bench_spawn(ref_argv));
+
+    for (u32 i = 0; i < BENCH_SMALL_FILES; i++) {
+        unlink(paths[i]);
+        free(paths[i]);
+    }
+    free(paths);
+    free(tool_argv);
+    free(ref_argv);
+    rmdir(small_dir);
+    unlink(big);
+    rmdir(dir);
+}
+
+int main(int argc, char* argv[]) {
+    printf("{\n  \"clic_version\": \"%s\",\n  \"results\": [", CLI_VERSION_STRING);
+
+    for (u32 o = 0; o < BENCH_OPTS_PER_CMD; o++) {
+        sprintf(bench_lazy_names[o], "-o%u, --option-%u", o, o);
+    }
+    for (u32 i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++) {
+        bench_parser(BENCH_COMMANDS, bench_sizes[i]);
+        bench_parser(BENCH_OPTIONS, bench_sizes[i]);
+        bench_parser(BENCH_LAZY, bench_sizes[i]);
+    }
+
+    if (argc > 1)
+        bench_tools(argv[1]);
+
+    printf("\n  ]\n}\n");
+    cli_thread_arena_release();
+    return 0;
+}
@@ -1,10 +1,26 @@
 /*
-    cli.h - v0.1.1 - Command-Line interface application framework for C
+    cli.h - v0.2.0 - Command-Line interface application framework for C
 
     Do this:
         #define CLI_IMPLEMENTATION
     before you include this file in *one* C or C++ file to create the implementation.
 
+    Parallel batch mode and cli_pool use pthreads; link with -pthread or define
+        #define CLI_NO_THREADS
+    to compile them out (batch invocations then always run sequentially).
+
+    Option values are views into argv. To get the old behavior of copying each
+    value into a fixed 256 byte buffer inside cli_option, define
+        #define CLI_INLINE_VALUE
+    before *every* include of this file.
+
+    To build in per-invocation timing and counters, define
+        #define CLI_ENABLE_TRACE
+    before *every* include of this file. Tracing is then switched on at run
+    time by setting CLIC_TRACE to a file descriptor number or a file path.
+    Each invocation writes one JSON line there, or Chrome trace events if
+    CLIC_TRACE_FORMAT=chrome. Without the define it compiles to nothing.
+
     LICENSE
 
         ISC License
@@ -25,6 +41,17 @@
 
     REVISION HISTORY
 
+        0.2.0  (2026-10-16) subcommands, typed options, option handles and sources, lazy commands, batch mode,
+                            response files, static and generated apps, completion, suggestions and tracing.
+                            Breaking changes:
+                              - cli_app_add_option() and cli_cmd_add_option() return a cli_opt handle (was void)
+                              - cli_option::value is a view into argv and NULL when absent; define
+                                CLI_INLINE_VALUE for the old 256 byte buffer
+                              - get_command_options() returns const cli_option* and needs a frozen app
+                              - cli_app::commands is an array of pointers; g_arena is gone, each app has its own
+                              - actions registered with cli_*_add_command_ex() take a const cli_parse_result*
+                              - "__complete" and "__dump" as the first argument are handled by cli_app_run(),
+                                and "@file" arguments are expanded
         0.1.1  (2026-01-12) undef possibly conflicting macro names
         0.1.0  (2026-01-12) initial release of clic
 */
@@ -33,9 +60,9 @@
 #define CLI_H
 
 #define CLI_VERSION_MAJOR 0
-#define CLI_VERSION_MINOR 1
-#define CLI_VERSION_PATCH 1
-#define CLI_VERSION_STRING "0.1.1"
+#define CLI_VERSION_MINOR 2
+#define CLI_VERSION_PATCH 0
+#define CLI_VERSION_STRING "0.2.0"
 
 #include <stdarg.h>
 #include <stdint.h>
@@ -51,6 +78,10 @@
 #include <dirent.h>
 #include <unistd.h>
 #include <stdnoreturn.h>
+#ifndef CLI_NO_THREADS
+    #include <pthread.h>
+    #include <stdatomic.h>
+#endif
 
 typedef int8_t i8;
 typedef uint8_t u8;
@@ -81,53 +112,478 @@ noreturn inline static void cli_panic(const char* fmt, ...) {
 typedef struct cli_option cli_option;
 typedef struct cli_command cli_command;
 typedef struct cli_app cli_app;
+typedef struct cli_arena cli_arena;
+typedef struct cli_help cli_help;
+typedef struct cli_config cli_config;
+typedef struct cli_parse_result cli_parse_result;
 typedef i32 (*cli_action)(cli_option** opts, u32 opt_count);
+typedef i32 (*cli_action_ex)(const cli_parse_result* result);  // Reads its options through handles, see cli_opt
+typedef void (*cli_setup)(cli_app* app, cli_command* cmd);      // Registers a lazy command's options
+
+// Type of an option's value. Values of typed options are converted and checked while parsing, so bad input is
+// reported before the action runs and actions read `as` instead of the string.
+typedef enum {
+    CLI_TYPE_STRING,    // No conversion
+    CLI_TYPE_INT,       // as.integer: decimal, optionally signed
+    CLI_TYPE_DOUBLE,    // as.real: decimal with optional fraction and exponent
+    CLI_TYPE_BOOL,      // as.boolean: true/false, yes/no, on/off, 1/0
+    CLI_TYPE_ENUM,      // as.choice: index of the value in `choices`
+    CLI_TYPE_SIZE,      // as.bytes: a byte count with an optional K, M, G, T, P or E suffix (powers of 1024)
+    CLI_TYPE_DURATION,  // as.nanoseconds: one or more of <n>d, h, m, s, ms, us or ns, e.g. "1h30m" or "250ms"
+    CLI_TYPE_PATH,      // Any non-empty string
+} cli_type;
+
+// Converted value of a typed option, by `type`. Flags have `boolean` set.
+typedef union {
+    i64 integer;
+    double real;
+    bool boolean;
+    u32 choice;
+    u64 bytes;
+    i64 nanoseconds;
+} cli_typed_value;
+
+// A single name split out of a comma-separated names string at registration time
+typedef struct {
+    const char* str;  // Points into the owning names string, NOT null-terminated
+    u32 len;
+    u32 hash;
+} cli_name;
+
+typedef struct {
+    const cli_name* name;  // Into the owner's name list
+    u32 index;             // Index into the owning table
+} cli_index_slot;
+
+// Open-addressing hash index mapping names to command/option indices. Probing only reads `tags`, sixteen slots per
+// cache line; a slot and its name are touched once the tag matches.
+typedef struct {
+    u32* tags;  // Name hash with the low bit set, 0 if the slot is empty
+    cli_index_slot* slots;
+    u32 capacity;  // Always a power of two
+    u32 count;
+} cli_name_index;
+
+// Help text of an app or command. Laid out on first use, or precomputed by clic-gen.
+struct cli_help {
+    const char* data;
+    size_t len;
+    u32 columns;  // Longest line. Precomputed text is only used where it needs no wrapping.
+};
 
 struct cli_option {
-    const char* names;  // Comma-separated names, e.g. "-f,--file"
-    const char* help_text;
-    cli_command* command;  // Associated command. NULL if global option.
+    // Hot: touched on every lookup and parse, and together fit in one cache line
+    const cli_name* name_list;  // Pre-split `names`
+    u32 name_count;
     bool required;
     bool is_flag;
     bool is_present;
-    char value[256];  // Parsed value
+    u8 type;  // cli_type
+#ifndef CLI_INLINE_VALUE
+    const char* value;  // Parsed value, a view into argv. NULL if not present.
+#endif
+    u32 value_len;
+    u32 value_count;      // Number of times a value option was given
+    const char** values;  // Every value in argv order (views into argv). `value` is the last one.
+    cli_typed_value as;   // `value` converted to `type`
+
+    // Cold: only needed for help and error messages
+    cli_command* command;  // Associated command. NULL if global option or statically defined.
+    const char* names;     // Comma-separated names, e.g. "-f,--file"
+    const char* help_text;
+    u32 position;  // Index among the options of `command`. In a parse result, index in `options` if given.
+    i64 min;       // Inclusive range of numeric types, unchecked when min == max
+    i64 max;
+    const char* const* choices;  // Values accepted by a CLI_TYPE_ENUM option
+    u32 choice_count;
+    const char* env;         // Environment variable read when the option isn't given
+    const char* config_key;  // "key" or "section.key" in the app's config file, read when `env` isn't set either
+#ifdef CLI_INLINE_VALUE
+    char value[256];  // Parsed value (copied). Last, so it doesn't push the other fields apart.
+#endif
 };
 
 struct cli_command {
     const char* names;
     cli_action action;
+    cli_action_ex action_ex;  // Run instead of `action` if set
+    cli_setup setup;          // Lazy commands until their first match, NULL once it has run
     const char* help_text;
+    const cli_name* name_list;
+    u32 name_count;
+    cli_name_index option_index;  // Lookup for this command's options. Empty for static commands, which are scanned.
+    const cli_option* options;    // In registration order. Built by cli_app_freeze().
+    u32 option_count;
+    cli_help** help;         // Help text, laid out on first use. Separate so static commands can stay read-only.
+    const cli_help* layout;  // Precomputed help from clic-gen, NULL otherwise
+    cli_command** children;  // Subcommands, in registration order. They inherit this command's options.
+    u32 child_count;
+    u32 child_capacity;
+    cli_name_index child_index;  // Lookup for `children`. Empty for static commands, which are scanned.
+
+    // Bitset over the options the command accepts (its own, then inherited), set for the required ones. Built by
+    // cli_app_freeze() and clic-gen; NULL in hand-written static definitions, which are checked option by option.
+    const u64* required;
+    // The same, set for the options with an environment variable or config key
+    const u64* sourced;
+    // Options accepted from the commands above. Set by cli_app_freeze() and clic-gen; 0 in hand-written static
+    // definitions, so handles to options of nested commands don't resolve there.
+    u32 inherited_option_count;
 };
 
+// Lookup functions and precomputed help emitted by clic-gen. They replace the name indices of a static app.
+typedef struct {
+    const cli_command* (*find_command)(const cli_command* parent, const char* str, size_t len, u32 hash);
+    const cli_option* (*find_option)(const cli_command* cmd, const char* str, size_t len, u32 hash);
+    const cli_help* help;  // App help, laid out for `batch_enabled`
+    bool batch_enabled;
+} cli_app_lookup;
+
 struct cli_app {
     const char* name;
     const char* version;
     const char* description;
 
-    cli_command* commands;
+    cli_command** commands;
     u32 command_count;
+    u32 command_capacity;
+    cli_name_index command_index;
 
     cli_option* options;
     u32 option_count;
+    u32 option_capacity;
+    cli_name_index option_index;        // Lookup for global options
+    const cli_option* global_options;  // Built by cli_app_freeze()
+    u32 global_option_count;
+
+    cli_action* default_action;
+    const cli_app_lookup* lookup;  // Generated lookup, NULL unless created from a clic-gen header
+
+    cli_arena* arena;    // Owns everything registered on the app
+    cli_help* help;      // Laid out on first use
+    bool frozen;         // No registration allowed; safe to share between threads
+    bool batch_enabled;  // Accept `--batch`/`--batch0` as the first argument
+
+    const char* config_path;  // See cli_app_set_config()
+    cli_config* config;       // Indexed the first time an option falls back to it
+
+    cli_command* setup_command;  // Lazy command whose setup is running; registration below it is open
+#ifndef CLI_NO_THREADS
+    pthread_mutex_t setup_lock;  // Setups allocate from `arena`, so they run one at a time
+#endif
+
+#ifdef CLI_ENABLE_TRACE
+    u64 trace_created;      // Monotonic time cli_app_create() returned
+    u64 trace_create_ns;    // Time spent in cli_app_create()
+    u64 trace_register_ns;  // Time from cli_app_create() returning to cli_app_freeze()
+#endif
+};
 
+// Compile-time app definition for cli_app_create_static(). Everything it points to is const and can live in
+// read-only memory: names are split and measured by the compiler, so nothing is registered at run time.
+//
+//     static const cli_option info_options[] = {
+//         CLI_OPTION(CLI_NAMES("-p", "--path"), true, false, "Path to inspect"),
+//         CLI_OPTION(CLI_NAMES("-v", "--verbose"), false, true, "Show extended information"),
+//     };
+//     static const cli_command* const commands[] = {
+//         CLI_COMMAND(CLI_NAMES("info", "i"), cmd_info, "Display information", CLI_OPTIONS(info_options)),
+//     };
+//     static const cli_app_def filetool = {"filetool", "1.0.0", "File utilities", NULL, CLI_COMMANDS(commands)};
+//
+// Typed options add CLI_TYPE(), CLI_RANGE() or CLI_CHOICES(array) after the help text, and options with defaults
+// from the environment or the config file add CLI_ENV() and CLI_CONFIG():
+//
+//         CLI_OPTION(CLI_NAMES("-t", "--threads"), false, false, "Threads", CLI_TYPE(CLI_TYPE_INT), CLI_RANGE(1, 64)),
+//
+// Subcommands are listed with CLI_SUBCOMMANDS(array) after the options. The macros must be used at file scope. Each
+// command or option takes 1 to 4 names.
+typedef struct {
+    const char* name;
+    const char* version;
+    const char* description;
     cli_action* default_action;
+    const cli_command* const* commands;
+    u32 command_count;
+    const cli_option* options;  // Global options
+    u32 option_count;
+    bool batch_enabled;
+    const cli_app_lookup* lookup;  // Set by clic-gen
+} cli_app_def;
+
+#define CLI_NAMES(...)                                                                                                 \
+    .names = CLI__JOIN(__VA_ARGS__), .name_list = (const cli_name[]){CLI__SPLIT(__VA_ARGS__)},                        \
+    .name_count = CLI__COUNT(__VA_ARGS__)
+#define CLI_OPTION(names, is_required, flag, text, ...)                                                                \
+    { names, .required = (is_required), .is_flag = (flag), .help_text = (text), __VA_ARGS__ }
+#define CLI_COMMAND(names, fn, text, ...)                                                                              \
+    &(const cli_command) {                                                                                             \
+        names, .action = (fn), .help_text = (text), .help = &(cli_help*){NULL}, __VA_ARGS__                            \
+    }
+#define CLI_OPTIONS(array) .options = (array), .option_count = sizeof(array) / sizeof((array)[0])
+#define CLI_COMMANDS(array) .commands = (array), .command_count = sizeof(array) / sizeof((array)[0])
+#define CLI_TYPE(t) .type = (t)
+#define CLI_RANGE(lo, hi) .min = (lo), .max = (hi)
+#define CLI_CHOICES(array) .type = CLI_TYPE_ENUM, .choices = (array), .choice_count = sizeof(array) / sizeof((array)[0])
+#define CLI_ENV(name) .env = (name)
+#define CLI_CONFIG(key) .config_key = (key)
+#define CLI_SUBCOMMANDS(array) .children = (cli_command**)(array), .child_count = sizeof(array) / sizeof((array)[0])
+
+// C has no way to hash a string literal in a static initializer, so static names carry a hash of 0 and are matched
+// by length and contents
+#define CLI__NAME(s) {"" s, sizeof(s) - 1, 0}
+
+#define CLI__PICK(_1, _2, _3, _4, n, ...) n
+#define CLI__COUNT(...) CLI__PICK(__VA_ARGS__, 4, 3, 2, 1, 0)
+#define CLI__JOIN(...) CLI__PICK(__VA_ARGS__, CLI__JOIN4, CLI__JOIN3, CLI__JOIN2, CLI__JOIN1, )(__VA_ARGS__)
+#define CLI__JOIN1(a) a
+#define CLI__JOIN2(a, b) a ", " b
+#define CLI__JOIN3(a, b, c) a ", " b ", " c
+#define CLI__JOIN4(a, b, c, d) a ", " b ", " c ", " d
+#define CLI__SPLIT(...) CLI__PICK(__VA_ARGS__, CLI__SPLIT4, CLI__SPLIT3, CLI__SPLIT2, CLI__SPLIT1, )(__VA_ARGS__)
+#define CLI__SPLIT1(a) CLI__NAME(a)
+#define CLI__SPLIT2(a, b) CLI__NAME(a), CLI__NAME(b)
+#define CLI__SPLIT3(a, b, c) CLI__NAME(a), CLI__NAME(b), CLI__NAME(c)
+#define CLI__SPLIT4(a, b, c, d) CLI__NAME(a), CLI__NAME(b), CLI__NAME(c), CLI__NAME(d)
+
+typedef enum {
+    CLI_PARSE_OK,     // Ready for cli_dispatch()
+    CLI_PARSE_EXIT,   // Fully handled (help or version was printed), see exit_code
+    CLI_PARSE_ERROR,  // Invalid arguments, an error was printed to cli_stderr()
+} cli_parse_status;
+
+// Result of parsing one argv against a frozen app. Lives entirely in the arena passed to cli_parse().
+struct cli_parse_result {
+    const cli_app* app;
+    const cli_command* command;  // Innermost command of the path, NULL when the default action runs
+    cli_option** options;        // The command's own options in registration order, then those inherited from
+                                 // each parent, nearest first. Options that were given are per-call copies holding
+                                 // is_present/value, the others point at their read-only definition.
+    u32 option_count;
+    u64* present;  // Bit i is set when options[i] was given
+    char** args;   // Arguments after "--", not parsed as options. Views into argv.
+    u32 arg_count;
+    cli_parse_status status;
+    i32 exit_code;  // Exit code when status != CLI_PARSE_OK
 };
 
+// Handle to an option, returned when it is registered or by cli_app_find_option(). It is valid in the results of its
+// command and of every subcommand below it, where cli_is_present() and cli_value() find the option without a search.
+typedef struct {
+    const cli_command* command;  // NULL for a global option
+    u32 position;                // Among the options of `command`
+} cli_opt;
+
+typedef struct {
+    bool nul_delimited;  // Arguments end with '\0' and an empty argument ends the invocation
+    FILE* status;        // If set, "<index>\t<exit code>" is written here for every invocation
+    u32 jobs;            // Worker threads. 0 or 1 runs invocations sequentially on the calling thread.
+    bool unordered;      // With jobs > 1, emit output as invocations finish instead of in input order
+} cli_batch_config;
+
+// Buffered output. Writes go to `file` if set, else to `fd`; the buffer is flushed when full. Without either sink
+// the buffer grows instead and collects everything written.
+typedef struct {
+    FILE* file;
+    int fd;
+    char* data;
+    size_t len;
+    size_t capacity;
+} cli_writer;
+
+// Buffer size of writers with a sink
+#ifndef CLI_WRITER_SIZE
+    #define CLI_WRITER_SIZE (64 << 10)
+#endif
+
+// Deepest command path that is resolved, counting the top-level command. Deeper subcommands are never reached.
+#ifndef CLI_MAX_DEPTH
+    #define CLI_MAX_DEPTH 16
+#endif
+
+// Work-stealing thread pool. Tasks may submit further tasks; cli_pool_wait returns once all of them are done.
+typedef struct cli_pool cli_pool;
+typedef void (*cli_task)(void* arg, u32 worker);
+
 cli_app* cli_app_create(const char* name, const char* version, const char* description, cli_action* default_action);
+cli_app* cli_app_create_static(const cli_app_def* def);  // Frozen on return; `def` must outlive the app
 void cli_app_destroy(cli_app* app);
 void cli_app_print_info(const cli_app* app);
 
+// Finish registration. A frozen app is read-only and can be parsed against from any number of threads at once.
+// cli_app_run() and the batch functions freeze the app automatically.
+void cli_app_freeze(cli_app* app);
+
 cli_command* cli_app_add_command(cli_app* app, const char* names, cli_action action, const char* help_text);
-void cli_app_add_option(cli_app* app, const char* names, bool required, bool is_flag, const char* help_text);
-void cli_cmd_add_option(
+// Add a subcommand to `parent`, run as `app parent names...`. It accepts the options of every command above it as
+// well as its own. A command with subcommands may have a NULL action, its help is printed when it is run alone.
+cli_command* cli_cmd_add_command(
+  cli_app* app, cli_command* parent, const char* names, cli_action action, const char* help_text);
+// Commands whose action reads options through handles
+cli_command* cli_app_add_command_ex(cli_app* app, const char* names, cli_action_ex action, const char* help_text);
+cli_command* cli_cmd_add_command_ex(
+  cli_app* app, cli_command* parent, const char* names, cli_action_ex action, const char* help_text);
+// Commands registered by name only. `setup` runs the first time the command is matched, by parsing, completion or
+// cli_app_find_option(), and sets its `action` or `action_ex` and adds its options and subcommands. It may not
+// register anything outside the command. Invocations of other commands never pay for it.
+cli_command* cli_app_add_command_lazy(cli_app* app, const char* names, cli_setup setup, const char* help_text);
+cli_command* cli_cmd_add_command_lazy(
+  cli_app* app, cli_command* parent, const char* names, cli_setup setup, const char* help_text);
+cli_opt cli_app_add_option(cli_app* app, const char* names, bool required, bool is_flag, const char* help_text);
+cli_opt cli_cmd_add_option(
   cli_app* app, cli_command* cmd, const char* names, bool required, bool is_flag, const char* help_text);
 
+// Type of a typed option: `type`, plus the range of a numeric type or the choices of CLI_TYPE_ENUM. `choices` is not
+// copied and must outlive the app.
+typedef struct {
+    cli_type type;
+    i64 min;  // Inclusive, unchecked when min == max
+    i64 max;
+    const char* const* choices;
+    u32 choice_count;
+} cli_option_type;
+
+// Typed options always take a value
+cli_opt cli_app_add_typed_option(
+  cli_app* app, const char* names, bool required, const cli_option_type* type, const char* help_text);
+cli_opt cli_cmd_add_typed_option(cli_app* app,
+                                 cli_command* cmd,
+                                 const char* names,
+                                 bool required,
+                                 const cli_option_type* type,
+                                 const char* help_text);
+
+// Values for options missing from the command line: the environment variable `env`, then `config_key` in the file
+// set with cli_app_set_config(). Either may be NULL. Flags are set by a true value, as CLI_TYPE_BOOL spells it.
+void cli_app_set_option_source(cli_app* app, cli_opt handle, const char* env, const char* config_key);
+// Config file read for option sources, as `key = value` lines, optionally under `[section]` headers that name keys
+// "section.key". It is mapped and indexed the first time an option needs it, which never happens when the command
+// line sets them all. A missing file is an empty config. Set it before parsing.
+void cli_app_set_config(cli_app* app, const char* path);
+
+// Handle to the option `name` of `command`, a path of subcommand names separated by spaces such as "cluster node",
+// or of the global options if `command` is NULL. For static apps, whose options aren't registered. Panics if there
+// is no such option. `app` must be frozen.
+cli_opt cli_app_find_option(const cli_app* app, const char* command, const char* name);
+
 int cli_app_run(cli_app* app, const i32 argc, char** argv);
 
+// Reentrant parsing. If `arena` is NULL the result lives in the calling thread's arena and stays valid until the next
+// cli_parse() on that thread with a NULL arena. Otherwise it lives until the caller resets `arena`.
+cli_parse_result* cli_parse(const cli_app* app, cli_arena* arena, const i32 argc, char** argv);
+i32 cli_dispatch(const cli_parse_result* result);
+
+cli_arena* cli_arena_create(size_t chunk_size);  // 0 = default chunk size
+void cli_arena_destroy(cli_arena* arena);
+size_t cli_arena_mark(const cli_arena* arena);
+void cli_arena_reset(cli_arena* arena, size_t mark);  // Release everything allocated since `mark`
+
+// Per-thread state is shared by every app, so cli_app_destroy() leaves it alone. A thread that used it, the main
+// thread included, releases it once done with all apps; cli_pool workers do so on exit.
+cli_arena* cli_thread_arena(void);    // Per-thread scratch arena, created on first use
+void cli_thread_arena_release(void);  // Free this thread's arenas and cli_out() writer
+
+// Run one invocation per input record, reusing the registered app. By default records are lines with shell-style
+// quoting. Returns 0 if every invocation succeeded, 1 otherwise.
+int cli_app_run_batch(cli_app* app, FILE* in);
+int cli_app_run_batch_ex(cli_app* app, FILE* in, const cli_batch_config* config);
+void cli_app_enable_batch(cli_app* app, bool enabled);
+
+// Streams for help, errors and action output. These are stdout/stderr, except inside a parallel batch invocation
+// where they capture that invocation's output. Actions should write through them to keep batch output intact.
+FILE* cli_stdout(void);
+FILE* cli_stderr(void);
+
+void cli_writer_init(cli_writer* writer, FILE* file, int fd);  // fd = -1 and file = NULL for an in-memory writer
+void cli_writer_free(cli_writer* writer);                      // Flushes first
+bool cli_writer_flush(cli_writer* writer);
+void cli_write(cli_writer* writer, const void* data, size_t len);
+void cli_write_str(cli_writer* writer, const char* str);
+void cli_write_u64(cli_writer* writer, u64 value);
+void cli_write_pad(cli_writer* writer, char c, size_t count);
+__attribute__((format(printf, 2, 3))) void cli_writef(cli_writer* writer, const char* fmt, ...);
+
+// Per-thread writer on cli_stdout(), flushed after every invocation. Don't mix it with stdio calls on cli_stdout()
+// in the same action without flushing it first.
+cli_writer* cli_out(void);
+
+#ifndef CLI_NO_THREADS
+cli_pool* cli_pool_create(u32 threads);  // 0 = one per online CPU
+void cli_pool_destroy(cli_pool* pool);
+void cli_pool_submit(cli_pool* pool, cli_task task, void* arg);
+void cli_pool_wait(cli_pool* pool);
+u32 cli_pool_size(const cli_pool* pool);
+#endif
+
+// FNV-1a, used for every name lookup
+static inline u32 cli_hash_name(const char* str, size_t len) {
+    u32 hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (u8)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// A hash of 0 means the name was defined statically and never hashed
+static inline bool cli_name_equals(const cli_name* name, const char* str, size_t len, u32 hash) {
+    return (name->hash == hash || name->hash == 0) && name->len == len && memcmp(name->str, str, len) == 0;
+}
+
+static inline bool cli_option_has_name(const cli_option* opt, const char* str, size_t len, u32 hash) {
+    for (u32 i = 0; i < opt->name_count; i++) {
+        if (cli_name_equals(&opt->name_list[i], str, len, hash))
+            return true;
+    }
+    return false;
+}
+
+// Slot of `hash` in a minimal perfect hash built by clic-gen: the bucket's seed is mixed in and the result reduced
+// to one of `count` slots
+static inline u32 cli_mph_slot(u32 hash, const u32* seeds, u32 seed_count, u32 count) {
+    u32 h = hash ^ seeds[hash % seed_count];
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h % count;
+}
+
+// Index of the option behind `handle` in `result->options`, or UINT32_MAX if the parsed command doesn't accept it.
+// Options are listed innermost command first, so an option of `command` sits a fixed distance from the end.
+static inline u32 cli_option_index(const cli_parse_result* result, cli_opt handle) {
+    const cli_command* cmd = handle.command;
+    const cli_option* defs = cmd ? cmd->options : result->app->global_options;
+    u32 accepted           = cmd ? cmd->option_count + cmd->inherited_option_count : result->app->global_option_count;
+    u32 index              = result->option_count - accepted + handle.position;
+    if (index >= result->option_count || result->options[index]->name_list != defs[handle.position].name_list)
+        return UINT32_MAX;
+    return index;
+}
+
+static inline bool cli_is_present(const cli_parse_result* result, cli_opt handle) {
+    u32 index = cli_option_index(result, handle);
+    return index != UINT32_MAX && result->options[index]->is_present;
+}
+
+// The option behind `handle`, for its `values` or typed value. NULL if the parsed command doesn't accept it.
+static inline const cli_option* cli_option_of(const cli_parse_result* result, cli_opt handle) {
+    u32 index = cli_option_index(result, handle);
+    return index != UINT32_MAX ? result->options[index] : NULL;
+}
+
+// The last value given for the option, NULL if it wasn't given
+static inline const char* cli_value(const cli_parse_result* result, cli_opt handle) {
+    u32 index = cli_option_index(result, handle);
+    return index != UINT32_MAX && result->options[index]->is_present ? result->options[index]->value : NULL;
+}
+
 static inline cli_option* cli_get_option(cli_option* opts, u32 count, const char* name) {
+    size_t len = strlen(name);
+    u32 hash   = cli_hash_name(name, len);
     for (u32 i = 0; i < count; i++) {
-        // TODO: Simple check that should get refactored. This should split and check each name.
-        if (strstr(opts[i].names, name) != NULL && opts[i].is_present) {
+        if (opts[i].is_present && cli_option_has_name(&opts[i], name, len, hash)) {
             return &opts[i];
         }
     }
@@ -139,6 +595,73 @@ static inline cli_option* cli_get_option(cli_option* opts, u32 count, const char
 
 #ifdef CLI_IMPLEMENTATION
 
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+/*********************************************************************/
+/* Tracing                                                           */
+/*********************************************************************/
+
+#ifdef CLI_ENABLE_TRACE
+    #include <fcntl.h>
+    #include <time.h>
+    #include <sys/syscall.h>
+
+// Reset at the start of every invocation on the thread running it
+typedef struct {
+    u64 parse_ns;  // Includes help_ns
+    u64 help_ns;
+    u64 action_ns;
+    u64 lookups;  // Name index lookups
+    u64 probes;   // Slots inspected by those lookups
+    u64 allocs;   // Arena pushes
+    u64 alloc_bytes;
+    u64 bytes_copied;
+} trace_counters;
+
+static int trace_fd = -2;  // -2 until trace_init() ran, -1 if tracing is off
+static bool trace_chrome;
+static _Thread_local trace_counters t_trace;
+
+static u64 trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+static void trace_init(void) {
+    if (trace_fd != -2)
+        return;
+
+    trace_fd           = -1;
+    const char* target = getenv("CLIC_TRACE");
+    if (target == NULL || *target == '\0')
+        return;
+
+    char* end;
+    long fd  = strtol(target, &end, 10);
+    trace_fd = *end == '\0' ? (int)fd : open(target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+    // Chrome's viewer accepts an array that is never closed, so only the opening bracket is written
+    const char* format = getenv("CLIC_TRACE_FORMAT");
+    trace_chrome       = format != NULL && strcmp(format, "chrome") == 0;
+    struct stat st;
+    if (trace_chrome && trace_fd >= 0 && (fstat(trace_fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0))
+        (void)!write(trace_fd, "[\n", 2);
+}
+
+    #define TRACE_ACTIVE (trace_fd >= 0)
+    #define TRACE_COUNT(field, n) (t_trace.field += (n))
+    #define TRACE_BEGIN(var) u64 var = TRACE_ACTIVE ? trace_now() : 0
+    #define TRACE_END(var, field) (t_trace.field += TRACE_ACTIVE ? trace_now() - var : 0)
+#else
+    #define TRACE_COUNT(field, n) ((void)0)
+    #define TRACE_BEGIN(var) ((void)0)
+    #define TRACE_END(var, field) ((void)0)
+#endif
+
 /*********************************************************************/
 /* Memory management                                                 */
 /*********************************************************************/
@@ -161,68 +684,199 @@ static inline cli_option* cli_get_option(cli_option* opts, u32 count, const char
         _a > _b ? _a : _b;                                                                                             \
     })
 
-typedef struct {
+// The arena is a linked list of chunks. The first chunk doubles as the arena handle and tracks the chunk currently
+// being pushed to. Positions are global across chunks, so any position can be restored with arena_pop_to().
+struct cli_arena {
+    cli_arena* current;    // Chunk currently being pushed to (only valid on the first chunk)
+    cli_arena* prev;       // Previous chunk, NULL for the first chunk
+    size_t base_position;  // Global position of this chunk's first byte
     size_t capacity;
-    size_t position;
-} cli_arena;
+    size_t position;  // Local to this chunk
+};
 
-cli_arena* g_arena;
+typedef struct {
+    cli_arena* arena;
+    size_t position;
+} cli_arena_temp;
 
-// Define constant memory sizes for arrays
-#define MAX_COMMAND_COUNT 64
-#define COMMANDS_SIZE (sizeof(cli_command) * MAX_COMMAND_COUNT)
+// Default size of each arena chunk. Allocations larger than this get a chunk of their own.
+#ifndef CLI_ARENA_CHUNK_SIZE
+    #define CLI_ARENA_CHUNK_SIZE KB(64)
+#endif
 
-#define MAX_OPTION_COUNT 64
-#define OPTIONS_SIZE (sizeof(cli_option) * MAX_OPTION_COUNT)
+// Define CLI_ARENA_MMAP to back arena chunks with anonymous mappings instead of malloc
+#ifdef CLI_ARENA_MMAP
+    #include <sys/mman.h>
+#endif
 
-static cli_arena* arena_create(size_t capacity) {
+static cli_arena* arena_chunk_alloc(size_t capacity) {
+#ifdef CLI_ARENA_MMAP
+    void* mem = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    cli_arena* out = mem == MAP_FAILED ? NULL : (cli_arena*)mem;
+#else
     cli_arena* out = (cli_arena*)malloc(capacity);
+#endif
     if (!out) {
         cli_panic("error: failed to allocate memory for arena");
     }
 
-    out->position = ARENA_BASE;
-    out->capacity = capacity;
+    out->current       = out;
+    out->prev          = NULL;
+    out->base_position = 0;
+    out->position      = ARENA_BASE;
+    out->capacity      = capacity;
 
     return out;
 }
 
+static void arena_chunk_release(cli_arena* chunk) {
+#ifdef CLI_ARENA_MMAP
+    munmap(chunk, chunk->capacity);
+#else
+    free(chunk);
+#endif
+}
+
+static cli_arena* arena_create(size_t capacity) {
+    return arena_chunk_alloc(MAX(capacity, ARENA_BASE + PAGESIZE));
+}
+
 static void arena_destroy(cli_arena* arena) {
-    free(arena);
+    cli_arena* chunk = arena->current;
+    while (chunk != NULL) {
+        cli_arena* prev = chunk->prev;
+        arena_chunk_release(chunk);
+        chunk = prev;
+    }
+}
+
+static size_t arena_position(const cli_arena* arena) {
+    return arena->current->base_position + arena->current->position;
 }
 
+// Pass `non_zero` = true to skip zeroing memory the caller overwrites anyway
 static void* arena_push(cli_arena* arena, size_t size, bool non_zero) {
-    size_t position_aligned = ALIGN_UP(arena->position, PAGESIZE);
+    TRACE_COUNT(allocs, 1);
+    TRACE_COUNT(alloc_bytes, size);
+
+    cli_arena* current      = arena->current;
+    size_t position_aligned = ALIGN_UP(current->position, PAGESIZE);
     size_t new_position     = position_aligned + size;
 
-    if (new_position > arena->capacity) {
-        cli_panic("error: arena memory full (%lu > %lu)", new_position, arena->capacity);
+    if (new_position > current->capacity) {
+        size_t capacity = MAX(arena->capacity, ALIGN_UP(ARENA_BASE, PAGESIZE) + size);
+        cli_arena* next = arena_chunk_alloc(capacity);
+        next->current       = NULL;
+        next->prev          = current;
+        next->base_position = current->base_position + current->capacity;
+
+        arena->current   = next;
+        current          = next;
+        position_aligned = ALIGN_UP(current->position, PAGESIZE);
+        new_position     = position_aligned + size;
     }
 
-    arena->position = new_position;
-    u8* out         = (u8*)arena + position_aligned;
-    memset(out, 0, size);
+    current->position = new_position;
+    u8* out           = (u8*)current + position_aligned;
+    if (!non_zero)
+        memset(out, 0, size);
 
     return out;
 }
 
-static void arena_pop(cli_arena* arena, size_t size) {
-    size = MIN(size, arena->position - ARENA_BASE);
-    arena->position -= size;
-}
-
 static void arena_pop_to(cli_arena* arena, size_t position) {
-    size_t size = position < arena->position ? arena->position - 1 : 0;
-    arena_pop(arena, size);
+    position = MAX(position, ARENA_BASE);
+
+    // Release every chunk that starts above the target position
+    cli_arena* current = arena->current;
+    while (current->base_position >= position) {
+        cli_arena* prev = current->prev;
+        arena_chunk_release(current);
+        current = prev;
+    }
+
+    arena->current = current;
+    size_t local   = position - current->base_position;
+    if (local < current->position)
+        current->position = local;
 }
 
 static void arena_clear(cli_arena* arena) {
     arena_pop_to(arena, ARENA_BASE);
 }
 
-#define ARENA_ALLOC(type) (type*)arena_push(g_arena, sizeof(type), false)
-#define ARENA_ALLOC_ARRAY(type, count) (type*)arena_push(g_arena, sizeof(type) * (count), false);
-#define MINIMUM_CAPACITY (COMMANDS_SIZE + OPTIONS_SIZE + ARENA_BASE + sizeof(cli_app))
+// Scratch scopes: everything pushed between begin and end is released by end
+static cli_arena_temp arena_temp_begin(cli_arena* arena) {
+    cli_arena_temp temp = {arena, arena_position(arena)};
+    return temp;
+}
+
+static void arena_temp_end(cli_arena_temp temp) {
+    arena_pop_to(temp.arena, temp.position);
+}
+
+// Grow an array by doubling. The old block is left behind in the arena.
+static void* arena_grow_array(cli_arena* arena, void* items, size_t item_size, u32 count, u32* capacity) {
+    if (count < *capacity)
+        return items;
+
+    u32 new_capacity = *capacity ? *capacity * 2 : 16;
+    void* out        = arena_push(arena, item_size * new_capacity, true);
+    if (items != NULL)  // NULL before the first growth, where count is 0
+        memcpy(out, items, item_size * count);
+    TRACE_COUNT(bytes_copied, item_size * count);
+    *capacity = new_capacity;
+
+    return out;
+}
+
+cli_arena* cli_arena_create(size_t chunk_size) {
+    return arena_create(chunk_size ? chunk_size : CLI_ARENA_CHUNK_SIZE);
+}
+
+void cli_arena_destroy(cli_arena* arena) {
+    arena_destroy(arena);
+}
+
+size_t cli_arena_mark(const cli_arena* arena) {
+    return arena_position(arena);
+}
+
+void cli_arena_reset(cli_arena* arena, size_t mark) {
+    arena_pop_to(arena, mark);
+}
+
+static _Thread_local cli_arena* t_arena;
+
+cli_arena* cli_thread_arena(void) {
+    if (t_arena == NULL)
+        t_arena = arena_create(CLI_ARENA_CHUNK_SIZE);
+    return t_arena;
+}
+
+static _Thread_local cli_arena* t_parse_arena;
+
+static _Thread_local cli_writer* t_out;
+
+void cli_thread_arena_release(void) {
+    if (t_out != NULL) {
+        cli_writer_free(t_out);
+        free(t_out);
+        t_out = NULL;
+    }
+    if (t_arena != NULL) {
+        arena_destroy(t_arena);
+        t_arena = NULL;
+    }
+    if (t_parse_arena != NULL) {
+        arena_destroy(t_parse_arena);
+        t_parse_arena = NULL;
+    }
+}
+
+#define ARENA_ALLOC(arena, type) (type*)arena_push(arena, sizeof(type), false)
+#define ARENA_ALLOC_ARRAY(arena, type, count) (type*)arena_push(arena, sizeof(type) * (count), false)
+#define BITSET_WORDS(bits) (((bits) + 63) / 64)
 
 /*********************************************************************/
 /* Internal helpers                                                  */
@@ -230,151 +884,290 @@ static void arena_clear(cli_arena* arena) {
 
 #define STREQ(s1, s2) strcmp(s1, s2) == 0
 
-static void free_string_array(char** arr, size_t count) {
-    if (arr == NULL)
-        return;
-    for (size_t i = 0; i < count; i++) {
-        free(arr[i]);
+// Split a comma-separated names string into views. Runs once per registration.
+static cli_name* split_names(cli_arena* arena, const char* names, u32* name_count) {
+    u32 max_count = 1;
+    for (const char* c = names; *c; c++) {
+        if (*c == ',')
+            max_count++;
     }
-    free(arr);
-}
 
-static char** split_names(const char* names, size_t* name_count) {
-    char** buffer = NULL;
-    *name_count   = 0;
+    cli_name* out = (cli_name*)arena_push(arena, sizeof(cli_name) * max_count, true);
 
-    char* str_cpy = strdup(names);
-    if (str_cpy == NULL)
-        return NULL;
+    *name_count       = 0;
+    const char* token = names;
+    while (*token) {
+        const char* end = strchr(token, ',');
+        if (end == NULL)
+            end = token + strlen(token);
 
-    char* token = strtok(str_cpy, ",");
-    while (token != NULL) {
-        // skip leading whitespace (for "name, -n" style)
-        while (*token == ' ')
-            token++;
+        // skip surrounding whitespace (for "name, -n" style)
+        const char* first = token;
+        const char* last  = end;
+        while (first < last && *first == ' ')
+            first++;
+        while (last > first && last[-1] == ' ')
+            last--;
 
-        char** new_buffer = realloc(buffer, sizeof(char*) * (*name_count + 1));
-        if (new_buffer == NULL) {
-            free_string_array(buffer, *name_count);
-            free(str_cpy);
-            return NULL;
-        }
-        buffer              = new_buffer;
-        buffer[*name_count] = strdup(token);
-        if (buffer[*name_count] == NULL) {
-            free_string_array(buffer, *name_count);
-            free(str_cpy);
-            return NULL;
+        if (last > first) {
+            cli_name* name = &out[(*name_count)++];
+            name->str      = first;
+            name->len      = (u32)(last - first);
+            name->hash     = cli_hash_name(first, name->len);
         }
-        (*name_count)++;
-        token = strtok(NULL, ",");
+
+        token = *end ? end + 1 : end;
+    }
+
+    return out;
+}
+
+static inline u32 name_index_tag(u32 hash) {
+    return hash | 1;
+}
+
+static void name_index_grow(cli_arena* arena, cli_name_index* index) {
+    u32 capacity          = index->capacity ? index->capacity * 2 : 16;
+    u32* tags             = ARENA_ALLOC_ARRAY(arena, u32, capacity);
+    cli_index_slot* slots = ARENA_ALLOC_ARRAY(arena, cli_index_slot, capacity);
+
+    for (u32 i = 0; i < index->capacity; i++) {
+        if (index->tags[i] == 0)
+            continue;
+        u32 pos = index->slots[i].name->hash & (capacity - 1);
+        while (tags[pos] != 0)
+            pos = (pos + 1) & (capacity - 1);
+        tags[pos]  = index->tags[i];
+        slots[pos] = index->slots[i];
     }
 
-    free(str_cpy);
-    return buffer;
+    index->tags     = tags;
+    index->slots    = slots;
+    index->capacity = capacity;
 }
 
-static bool option_matches_name(const cli_option* opt, const char* name) {
-    size_t name_count;
-    char** names = split_names(opt->names, &name_count);
-    if (names == NULL)
+// First registration of a name wins, matching the order of the old linear scan. `name` must outlive the index.
+static void name_index_insert(cli_arena* arena, cli_name_index* index, const cli_name* name, u32 value) {
+    if ((index->count + 1) * 2 > index->capacity)
+        name_index_grow(arena, index);
+
+    u32 tag = name_index_tag(name->hash);
+    u32 pos = name->hash & (index->capacity - 1);
+    while (index->tags[pos] != 0) {
+        if (index->tags[pos] == tag && cli_name_equals(index->slots[pos].name, name->str, name->len, name->hash))
+            return;
+        pos = (pos + 1) & (index->capacity - 1);
+    }
+
+    index->tags[pos]        = tag;
+    index->slots[pos].name  = name;
+    index->slots[pos].index = value;
+    index->count++;
+}
+
+static bool name_index_find(const cli_name_index* index, const char* str, size_t len, u32 hash, u32* out) {
+    if (index->count == 0)
         return false;
 
-    bool found = false;
-    for (size_t i = 0; i < name_count; i++) {
-        if (strcmp(names[i], name) == 0) {
-            found = true;
-            break;
+    u32 tag = name_index_tag(hash);
+    u32 pos = hash & (index->capacity - 1);
+    TRACE_COUNT(lookups, 1);
+    while (index->tags[pos] != 0) {
+        TRACE_COUNT(probes, 1);
+        if (index->tags[pos] == tag && cli_name_equals(index->slots[pos].name, str, len, hash)) {
+            *out = index->slots[pos].index;
+            return true;
         }
+        pos = (pos + 1) & (index->capacity - 1);
     }
 
-    free_string_array(names, name_count);
-    return found;
+    return false;
 }
 
-static cli_command* find_command(cli_app* app, const char* name) {
-    for (u32 i = 0; i < app->command_count; i++) {
-        cli_command* cmd = &app->commands[i];
-        size_t name_count;
-        char** names = split_names(cmd->names, &name_count);
-        if (names == NULL)
-            continue;
+static bool name_list_find(const cli_name* names, u32 count, const char* str, size_t len, u32 hash) {
+    for (u32 i = 0; i < count; i++) {
+        TRACE_COUNT(probes, 1);
+        if (cli_name_equals(&names[i], str, len, hash))
+            return true;
+    }
+    return false;
+}
 
-        bool found = false;
-        for (size_t k = 0; k < name_count; k++) {
-            if (strcmp(names[k], name) == 0) {
-                found = true;
-                break;
-            }
-        }
+// Commands from the top level down to the one being run. Each level is resolved through its parent's own index, so
+// finding a command costs one lookup per level however many commands the app has.
+typedef struct {
+    const cli_command* items[CLI_MAX_DEPTH];
+    u32 depth;
+} command_path;
 
-        free_string_array(names, name_count);
-        if (found)
-            return cmd;
+static void command_setup(cli_app* app, const cli_command* parent, cli_command* cmd);
+
+// Find a subcommand of `parent`, or a top-level command if `parent` is NULL. `name` needs no terminator.
+// Statically defined apps have no index, their names are scanned instead.
+static const cli_command* lookup_command(const cli_app* app, const cli_command* parent, const char* name, size_t len) {
+    cli_command* const* cmds    = parent ? parent->children : app->commands;
+    u32 count                   = parent ? parent->child_count : app->command_count;
+    const cli_name_index* index = parent ? &parent->child_index : &app->command_index;
+    u32 hash                    = cli_hash_name(name, len);
+    u32 position;
+    if (app->lookup != NULL) {
+        TRACE_COUNT(lookups, 1);
+        return app->lookup->find_command(parent, name, len, hash);
     }
+    if (index->capacity != 0)
+        return name_index_find(index, name, len, hash, &position) ? cmds[position] : NULL;
 
+    TRACE_COUNT(lookups, 1);
+    for (u32 i = 0; i < count; i++) {
+        if (name_list_find(cmds[i]->name_list, cmds[i]->name_count, name, len, hash))
+            return cmds[i];
+    }
     return NULL;
 }
 
-// Find an option by argument name (e.g., "-f" or "--file")
-static cli_option* find_option(cli_app* app, const char* arg) {
-    for (u32 i = 0; i < app->option_count; i++) {
-        if (option_matches_name(&app->options[i], arg)) {
-            return &app->options[i];
-        }
+// lookup_command(), running the setup of a lazy command before anything else sees it
+static const cli_command* find_command(const cli_app* app, const cli_command* parent, const char* name, size_t len) {
+    const cli_command* cmd = lookup_command(app, parent, name, len);
+    if (cmd != NULL && __atomic_load_n(&cmd->setup, __ATOMIC_ACQUIRE) != NULL)
+        command_setup((cli_app*)app, parent, (cli_command*)cmd);
+    return cmd;
+}
+
+// Option definitions of `cmd` (or the global options), in registration order. Requires a frozen app.
+const cli_option* get_command_options(const cli_app* app, const cli_command* cmd, u32* opt_count) {
+    assert(app->frozen);
+    *opt_count = cmd ? cmd->option_count : app->global_option_count;
+    return cmd ? cmd->options : app->global_options;
+}
+
+static const cli_option* find_option_hashed(
+  const cli_app* app, const cli_command* cmd, const char* arg, size_t len, u32 hash) {
+    u32 opt_count;
+    const cli_option* opts      = get_command_options(app, cmd, &opt_count);
+    const cli_name_index* index = cmd ? &cmd->option_index : &app->option_index;
+    u32 position;
+    if (app->lookup != NULL) {
+        TRACE_COUNT(lookups, 1);
+        return app->lookup->find_option(cmd, arg, len, hash);
     }
+    if (index->capacity != 0)
+        return name_index_find(index, arg, len, hash, &position) ? &opts[position] : NULL;
 
+    TRACE_COUNT(lookups, 1);
+    for (u32 i = 0; i < opt_count; i++) {
+        if (name_list_find(opts[i].name_list, opts[i].name_count, arg, len, hash))
+            return &opts[i];
+    }
     return NULL;
 }
 
-static cli_option* find_option_from_list(cli_option** opts, u32 opt_count, const char* arg) {
-    assert(opts);
-    assert(opt_count > 0);
-    for (u32 i = 0; i < opt_count; i++) {
-        if (option_matches_name(opts[i], arg)) {
-            return opts[i];
-        }
+// Find an option of the innermost command of `path` or, failing that, of each command above it in turn. The global
+// options if `path` is empty. `arg` needs no terminator. `*position` is set to its index in what get_option_values()
+// returns for `path`.
+static const cli_option* find_path_option(
+  const cli_app* app, const command_path* path, const char* arg, size_t len, u32* position) {
+    u32 hash = cli_hash_name(arg, len);
+    if (path->depth == 0) {
+        const cli_option* opt = find_option_hashed(app, NULL, arg, len, hash);
+        *position             = opt ? (u32)(opt - app->global_options) : 0;
+        return opt;
     }
 
+    u32 offset = 0;
+    for (u32 level = path->depth; level-- > 0;) {
+        const cli_command* cmd = path->items[level];
+        const cli_option* opt  = find_option_hashed(app, cmd, arg, len, hash);
+        if (opt != NULL) {
+            *position = offset + (u32)(opt - cmd->options);
+            return opt;
+        }
+        offset += cmd->option_count;
+    }
     return NULL;
 }
 
-// Check if argument looks like an ooption (starts with -)
+// Kinds of argv tokens, told apart by their first bytes alone
+typedef enum {
+    TOKEN_WORD,   // Not an option: a command name, a value, "-" or ""
+    TOKEN_SHORT,  // "-x", "-name", "-xyz" (bundled flags) or "-xVALUE"
+    TOKEN_LONG,   // "--name" or "--name=value"
+    TOKEN_END,    // "--": every argument after it is left to the action
+} token_kind;
+
+enum { LEX_OTHER, LEX_NUL, LEX_DASH };
+
+static const u8 lex_class[256] = {['\0'] = LEX_NUL, ['-'] = LEX_DASH};
+
+// Kind of a token starting with '-', by the class of its second byte
+static const u8 lex_dash_kind[] = {[LEX_OTHER] = TOKEN_SHORT, [LEX_NUL] = TOKEN_WORD, [LEX_DASH] = TOKEN_LONG};
+
+static token_kind lex_token(const char* arg) {
+    if (lex_class[(u8)arg[0]] != LEX_DASH)
+        return TOKEN_WORD;
+
+    token_kind kind = (token_kind)lex_dash_kind[lex_class[(u8)arg[1]]];
+    return kind == TOKEN_LONG && arg[2] == '\0' ? TOKEN_END : kind;
+}
+
+// Check if argument looks like an option ("-" alone is a word, conventionally stdin)
 static bool is_option_arg(const char* arg) {
-    return arg != NULL && arg[0] == '-';
+    return arg != NULL && lex_token(arg) != TOKEN_WORD;
 }
 
-cli_option** get_command_options(const cli_app* app, const cli_command* cmd, u32* opt_count) {
-    cli_option** opts = NULL;
-    *opt_count        = 0;
-    for (u32 i = 0; i < app->option_count; i++) {
-        cli_option* opt = &app->options[i];
-        if (opt->command == cmd) {
-            cli_option** opts_new = realloc(opts, sizeof(cli_option*) * (*opt_count + 1));
-            if (!opts_new) {
-                free(opts);
-                return NULL;
-            }
-            opts             = opts_new;
-            opts[*opt_count] = opt;
-            if (opts[*opt_count] == NULL) {
-                free(opts);
-                return NULL;
-            }
-            (*opt_count)++;
+// The options `path` accepts: its innermost command's, then each parent's, or the global options if `path` is empty.
+// Entries point at the read-only definitions until option_given() swaps in a per-invocation copy, so a parse only
+// copies the options that appear on the command line, and one app can be parsed against from several threads.
+static cli_option** get_option_values(const cli_app* app, const command_path* path, cli_arena* arena, u32* opt_count) {
+    *opt_count = path->depth == 0 ? app->global_option_count : 0;
+    for (u32 level = 0; level < path->depth; level++) {
+        *opt_count += path->items[level]->option_count;
+    }
+    if (*opt_count == 0)
+        return NULL;
+
+    cli_option** opts = (cli_option**)arena_push(arena, sizeof(cli_option*) * *opt_count, true);
+    u32 filled        = 0;
+    for (u32 i = 0; path->depth == 0 && i < *opt_count; i++) {
+        opts[filled++] = (cli_option*)&app->global_options[i];
+    }
+    for (u32 level = path->depth; level-- > 0;) {
+        const cli_command* cmd = path->items[level];
+        for (u32 i = 0; i < cmd->option_count; i++) {
+            opts[filled++] = (cli_option*)&cmd->options[i];
         }
     }
+
     return opts;
 }
 
+// Writable copy of opts[position], made the first time the option is given. Copies have position == index in opts.
+static cli_option* option_given(cli_arena* arena, cli_option** opts, u64* present, u32 position) {
+    u64 bit = 1ull << (position % 64);
+    if (present[position / 64] & bit)
+        return opts[position];
+
+    cli_option* opt  = (cli_option*)arena_push(arena, sizeof(cli_option), true);
+    *opt             = *opts[position];
+    opt->position    = position;
+    opt->is_present  = true;
+    opt->value_len   = 0;
+    opt->value_count = 0;
+    opt->values      = NULL;
+    TRACE_COUNT(bytes_copied, sizeof(cli_option));
+
+    present[position / 64] |= bit;
+    opts[position] = opt;
+    return opt;
+}
+
 /*********************************************************************/
 /* Help text generation                                              */
 /*********************************************************************/
 
-static size_t calc_longest_cmd(const cli_command* cmds, size_t count) {
+static size_t calc_longest_cmd(cli_command* const* cmds, size_t count) {
     size_t longest = 0;
     for (size_t i = 0; i < count; i++) {
-        size_t len = strlen(cmds[i].names);
+        size_t len = strlen(cmds[i]->names);
         if (len > longest)
             longest = len;
     }
@@ -382,265 +1175,3084 @@ static size_t calc_longest_cmd(const cli_command* cmds, size_t count) {
     return longest;
 }
 
-static size_t calc_longest_opt(cli_option** opts, size_t count) {
+static size_t calc_longest_opt(const cli_option* opts, size_t count) {
     size_t longest = 0;
     for (size_t i = 0; i < count; i++) {
-        size_t len = strlen(opts[i]->names);
+        size_t len = strlen(opts[i].names);
         if (len > longest)
             longest = len;
     }
     return longest;
 }
 
-static void print_app_help(const cli_app* app) {
-    printf("%s - %s\n%s\n\n", app->name, app->version, app->description);
+// -1 until help_width() ran. clic-gen sets it to 0 to lay out help without wrapping.
+static int help_cached_width = -1;
 
-    printf("USAGE\n");
-    printf("  %s <command> [options]\n\n", app->name);
+// Columns available to help text: the terminal width when stdout is a terminal, else $COLUMNS, else 0 (no wrapping).
+// Computed once per process.
+static size_t help_width(void) {
+    int width = __atomic_load_n(&help_cached_width, __ATOMIC_RELAXED);
+    if (width >= 0)
+        return (size_t)width;
 
-    if (app->command_count > 0) {
-        printf("COMMANDS\n");
-        size_t longest = calc_longest_cmd(app->commands, app->command_count);
+    struct winsize ws;
+    const char* columns = getenv("COLUMNS");
+    if (isatty(STDOUT_FILENO) && ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0)
+        width = ws.ws_col;
+    else
+        width = columns ? MAX(atoi(columns), 0) : 0;
 
-        for (u32 i = 0; i < app->command_count; i++) {
-            const cli_command* cmd = &app->commands[i];
-            printf("  %-*s    %s\n", (int)longest, cmd->names, cmd->help_text);
-        }
-        printf("\n");
+    __atomic_store_n(&help_cached_width, width, __ATOMIC_RELAXED);
+    return (size_t)width;
+}
+
+// Write `text` starting at `column`, breaking lines at spaces to stay within the help width. `reserve` columns are
+// kept free on the last line for a suffix the caller writes next.
+static void help_write_wrapped(cli_writer* w, const char* text, size_t column, size_t reserve) {
+    size_t width = help_width();
+    size_t len   = strlen(text);
+    if (width < column + 20) {
+        cli_write(w, text, len);
+        return;
     }
 
-    printf("Run '%s <command> --help' for more information on a command.\n", app->name);
+    size_t avail = width - column;
+    while (len + reserve > avail) {
+        size_t cut = MIN(len, avail);
+        while (cut > 0 && text[cut] != ' ')
+            cut--;
+        if (cut == 0)
+            break;  // A single word longer than the line
+
+        cli_write(w, text, cut);
+        cli_write(w, "\n", 1);
+        cli_write_pad(w, ' ', column);
+        while (text[cut] == ' ')
+            cut++;
+        text += cut;
+        len -= cut;
+    }
+    cli_write(w, text, len);
 }
 
-static void print_command_help(const cli_app* app, const cli_command* cmd, cli_option** opts, u32* opt_count) {
-    printf("%s %s - %s\n\n", app->name, cmd->names, cmd->help_text);
+// Apps are shared between threads, so the first finished layout is published and any duplicate dropped
+static const cli_help* help_publish(cli_help** slot, cli_writer* w) {
+    cli_help* help = (cli_help*)malloc(sizeof(cli_help) + w->len);
+    if (help == NULL)
+        cli_panic("error: failed to allocate %zu bytes of help text", w->len);
+    help->data    = memcpy(help + 1, w->data, w->len);
+    help->len     = w->len;
+    help->columns = 0;
+    cli_writer_free(w);
 
-    u32 opt_count_;
-    cli_option** opts_ = NULL;
+    cli_help* expected = NULL;
+    if (__atomic_compare_exchange_n(slot, &expected, help, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return help;
 
-    if (opts == NULL) {
-        opts_ = get_command_options(app, cmd, &opt_count_);
-    } else {
-        assert(opt_count_);
-        opts_      = opts;
-        opt_count_ = *opt_count;
+    free(help);
+    return expected;
+}
+
+static bool help_fits(const cli_help* help) {
+    size_t width = help_width();
+    return help != NULL && (width == 0 || help->columns <= width);
+}
+
+static void help_write_commands(cli_writer* w, cli_command* const* cmds, u32 count) {
+    if (count == 0)
+        return;
+
+    cli_write_str(w, "COMMANDS\n");
+    size_t longest = calc_longest_cmd(cmds, count);
+    for (u32 i = 0; i < count; i++) {
+        const cli_command* cmd = cmds[i];
+        size_t len             = strlen(cmd->names);
+        cli_write(w, "  ", 2);
+        cli_write(w, cmd->names, len);
+        cli_write_pad(w, ' ', longest - len + 4);
+        help_write_wrapped(w, cmd->help_text ? cmd->help_text : "", longest + 6, 0);
+        cli_write(w, "\n", 1);
     }
+    cli_write(w, "\n", 1);
+}
 
-    if (opt_count_ > 0) {
-        printf("OPTIONS\n");
-        size_t longest = calc_longest_opt(opts_, opt_count_);
+static const char* const help_type_labels[] = {
+    [CLI_TYPE_STRING]   = "<value>",
+    [CLI_TYPE_INT]      = "<int>",
+    [CLI_TYPE_DOUBLE]   = "<number>",
+    [CLI_TYPE_BOOL]     = "<bool>",
+    [CLI_TYPE_ENUM]     = "<choice>",
+    [CLI_TYPE_SIZE]     = "<size>",
+    [CLI_TYPE_DURATION] = "<duration>",
+    [CLI_TYPE_PATH]     = "<path>",
+};
 
-        for (u32 i = 0; i < opt_count_; i++) {
-            const cli_option* opt = opts_[i];
-            const char* req       = opt->required ? " (required)" : "";
-            const char* type      = opt->is_flag ? "<flag> " : "<value>";
-            printf("  %-*s    %s    %s%s\n", (int)longest, opt->names, type, opt->help_text ? opt->help_text : "", req);
-        }
+static void help_write_options(cli_writer* w, const cli_option* opts, u32 count, size_t longest) {
+    for (u32 i = 0; i < count; i++) {
+        const cli_option* opt = &opts[i];
+        const char* req       = opt->required ? " (required)" : "";
+        const char* label     = opt->is_flag ? "<flag>" : help_type_labels[opt->type];
+        size_t len            = strlen(opt->names);
+        cli_write(w, "  ", 2);
+        cli_write(w, opt->names, len);
+        cli_write_pad(w, ' ', longest - len + 4);
+        cli_write_str(w, label);
+        cli_write_pad(w, ' ', 11 - strlen(label));
 
-        printf("\n");
+        // Choices follow the help text like "(required)": " [auto, always, never]"
+        size_t suffix = strlen(req) + (opt->choice_count ? 2 : 0);
+        for (u32 c = 0; c < opt->choice_count; c++) {
+            suffix += strlen(opt->choices[c]) + (c ? 2 : 0);
+        }
+        help_write_wrapped(w, opt->help_text ? opt->help_text : "", longest + 17, suffix);
+        for (u32 c = 0; c < opt->choice_count; c++) {
+            cli_write_str(w, c ? ", " : " [");
+            cli_write_str(w, opt->choices[c]);
+        }
+        if (opt->choice_count)
+            cli_write(w, "]", 1);
+        cli_write_str(w, req);
+        cli_write(w, "\n", 1);
     }
+}
 
-    if (opts == NULL)
-        free(opts_);
+// "app parent child", by the first name of every command above the innermost one
+static void help_write_path(cli_writer* w, const cli_app* app, const command_path* path) {
+    cli_write_str(w, app->name);
+    for (u32 level = 0; level + 1 < path->depth; level++) {
+        cli_write(w, " ", 1);
+        cli_write(w, path->items[level]->name_list[0].str, path->items[level]->name_list[0].len);
+    }
 }
 
-/*********************************************************************/
-/* Public API                                                        */
-/*********************************************************************/
+static const cli_help* app_help(const cli_app* app) {
+    const cli_app_lookup* lookup = app->lookup;
+    if (lookup != NULL && lookup->batch_enabled == app->batch_enabled && help_fits(lookup->help))
+        return lookup->help;
 
-cli_app* cli_app_create(const char* name, const char* version, const char* description, cli_action* default_action) {
-    // Initialize the arena allocator
-    g_arena = arena_create(MINIMUM_CAPACITY);
-    if (!g_arena)
-        cli_panic("fatal: failed to initialize memory arena");
-    assert(g_arena->capacity == MINIMUM_CAPACITY);
+    const cli_help* help = __atomic_load_n(&app->help, __ATOMIC_ACQUIRE);
+    if (help != NULL)
+        return help;
 
-    cli_app* app = ARENA_ALLOC(cli_app);
+    cli_writer w;
+    cli_writer_init(&w, NULL, -1);
+    cli_writef(&w, "%s - %s\n%s\n\n", app->name, app->version, app->description);
+
+    cli_writef(&w, "USAGE\n  %s <command> [options]\n", app->name);
+    if (app->batch_enabled)
+        cli_writef(&w, "  %s --batch|--batch0 [-j N] [--unordered] [file]\n", app->name);
+    cli_write(&w, "\n", 1);
+
+    help_write_commands(&w, app->commands, app->command_count);
+    cli_writef(&w, "Run '%s <command> --help' for more information on a command.\n", app->name);
+    return help_publish(&((cli_app*)app)->help, &w);
+}
+
+// Help of the innermost command of `path`. A command has a single parent, so its help can be cached per command.
+static const cli_help* command_help(const cli_app* app, const command_path* path) {
+    const cli_command* cmd = path->items[path->depth - 1];
+    if (help_fits(cmd->layout))
+        return cmd->layout;
+
+    const cli_help* help = __atomic_load_n(cmd->help, __ATOMIC_ACQUIRE);
+    if (help != NULL)
+        return help;
+
+    cli_writer w;
+    cli_writer_init(&w, NULL, -1);
+    help_write_path(&w, app, path);
+    cli_writef(&w, " %s - %s\n\n", cmd->names, cmd->help_text);
+
+    // Inherited options line up with the command's own
+    size_t longest = calc_longest_opt(cmd->options, cmd->option_count);
+    u32 inherited  = 0;
+    for (u32 level = 0; level + 1 < path->depth; level++) {
+        const cli_command* parent = path->items[level];
+        longest                   = MAX(longest, calc_longest_opt(parent->options, parent->option_count));
+        inherited += parent->option_count;
+    }
+
+    if (cmd->option_count > 0) {
+        cli_write_str(&w, "OPTIONS\n");
+        help_write_options(&w, cmd->options, cmd->option_count, longest);
+        cli_write(&w, "\n", 1);
+    }
+    if (inherited > 0) {
+        cli_write_str(&w, "INHERITED OPTIONS\n");
+        for (u32 level = path->depth - 1; level-- > 0;) {
+            help_write_options(&w, path->items[level]->options, path->items[level]->option_count, longest);
+        }
+        cli_write(&w, "\n", 1);
+    }
+
+    if (cmd->child_count > 0) {
+        help_write_commands(&w, cmd->children, cmd->child_count);
+        cli_write_str(&w, "Run '");
+        help_write_path(&w, app, path);
+        cli_writef(&w, " %.*s <command> --help' for more information on a command.\n", (int)cmd->name_list[0].len,
+                   cmd->name_list[0].str);
+    }
+
+    return help_publish(cmd->help, &w);
+}
+
+// Help is written with a single fwrite, which stdio passes straight to write() when it exceeds its buffer
+static void print_app_help(const cli_app* app) {
+    TRACE_BEGIN(start);
+    const cli_help* help = app_help(app);
+    fwrite(help->data, 1, help->len, cli_stdout());
+    TRACE_END(start, help_ns);
+}
+
+static void print_command_help(const cli_app* app, const command_path* path) {
+    TRACE_BEGIN(start);
+    const cli_help* help = command_help(app, path);
+    fwrite(help->data, 1, help->len, cli_stdout());
+    TRACE_END(start, help_ns);
+}
+
+/*********************************************************************/
+/* Config files                                                      */
+/*********************************************************************/
+
+// Keys and values are copied out of the mapping, which is dropped once indexed
+struct cli_config {
+    cli_arena* arena;      // Owns the config, its keys, values and index
+    cli_name_index index;  // Key to index in `values`
+    const char** values;
+    u32 count;
+    u32 capacity;
+};
+
+static void config_trim(const char** start, const char** end) {
+    while (*start < *end && (**start == ' ' || **start == '\t' || **start == '\r'))
+        ++*start;
+    while (*end > *start && ((*end)[-1] == ' ' || (*end)[-1] == '\t' || (*end)[-1] == '\r'))
+        --*end;
+}
+
+// "section.key" (or just "key" outside a section) maps to `value`. A key given again replaces its value.
+static void config_add(cli_config* config,
+                       const char* section,
+                       size_t section_len,
+                       const char* key,
+                       size_t key_len,
+                       const char* value,
+                       size_t value_len) {
+    cli_arena* arena = config->arena;
+    size_t len       = section_len + (section_len > 0) + key_len;
+    char* str        = (char*)arena_push(arena, len + value_len + 2, true);
+    char* copy       = str + len + 1;
+    if (section_len > 0) {
+        memcpy(str, section, section_len);
+        str[section_len] = '.';
+    }
+    memcpy(str + len - key_len, key, key_len);
+    memcpy(copy, value, value_len);
+    str[len]        = '\0';
+    copy[value_len] = '\0';
+    u32 hash        = cli_hash_name(str, len);
+
+    u32 position;
+    if (name_index_find(&config->index, str, len, hash, &position)) {
+        config->values[position] = copy;
+        return;
+    }
+
+    cli_name* name = ARENA_ALLOC(arena, cli_name);
+    *name          = (cli_name){str, (u32)len, hash};
+    config->values = (const char**)arena_grow_array(arena, config->values, sizeof(char*), config->count,
+                                                     &config->capacity);
+    config->values[config->count] = copy;
+    name_index_insert(arena, &config->index, name, config->count++);
+}
+
+// `key = value` lines and `[section]` headers. Blank lines, lines starting with '#' or ';' and lines without '=' are
+// skipped. Surrounding blanks are trimmed, and one pair of quotes around a value.
+static void config_index(cli_config* config, const char* src, const char* end) {
+    const char* section = NULL;
+    size_t section_len  = 0;
+    while (src < end) {
+        const char* line = src;
+        const char* eol  = (const char*)memchr(src, '\n', (size_t)(end - src));
+        src              = eol ? eol + 1 : end;
+        eol              = eol ? eol : end;
+        config_trim(&line, &eol);
+        if (line == eol || *line == '#' || *line == ';')
+            continue;
+
+        if (*line == '[' && eol[-1] == ']') {
+            const char* section_end = eol - 1;
+            section                 = line + 1;
+            config_trim(&section, &section_end);
+            section_len = (size_t)(section_end - section);
+            continue;
+        }
+
+        const char* equals = (const char*)memchr(line, '=', (size_t)(eol - line));
+        if (equals == NULL)
+            continue;
+        const char* key_end = equals;
+        const char* value   = equals + 1;
+        config_trim(&line, &key_end);
+        config_trim(&value, &eol);
+        if (eol - value >= 2 && (*value == '"' || *value == '\'') && eol[-1] == *value) {
+            value++;
+            eol--;
+        }
+        if (line < key_end)
+            config_add(config, section, section_len, line, (size_t)(key_end - line), value, (size_t)(eol - value));
+    }
+}
+
+static cli_config* config_load(const char* path) {
+    cli_arena* arena   = arena_create(CLI_ARENA_CHUNK_SIZE);
+    cli_config* config = ARENA_ALLOC(arena, cli_config);
+    config->arena      = arena;
+
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (errno != ENOENT)
+            fprintf(cli_stderr(), "warning: ignoring config file '%s': %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return config;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void* base  = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(cli_stderr(), "warning: ignoring config file '%s': %s\n", path, strerror(errno));
+        return config;
+    }
+    if (base != NULL) {
+        madvise(base, size, MADV_SEQUENTIAL);
+        config_index(config, (const char*)base, (const char*)base + size);
+        munmap(base, size);
+    }
+    return config;
+}
+
+// Value of `key` in the app's config file, NULL if it has none. Apps are shared between threads, so the first index
+// built is published and any duplicate dropped.
+static const char* config_find(const cli_app* app, const char* key) {
+    cli_config** slot  = &((cli_app*)app)->config;
+    cli_config* config = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (config == NULL && app->config_path == NULL)
+        return NULL;
+    if (config == NULL) {
+        cli_config* loaded = config_load(app->config_path);
+        if (__atomic_compare_exchange_n(slot, &config, loaded, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            config = loaded;
+        else
+            arena_destroy(loaded->arena);
+    }
+
+    size_t len = strlen(key);
+    u32 position;
+    if (!name_index_find(&config->index, key, len, cli_hash_name(key, len), &position))
+        return NULL;
+    return config->values[position];
+}
+
+/*********************************************************************/
+/* Public API                                                        */
+/*********************************************************************/
+
+cli_app* cli_app_create(const char* name, const char* version, const char* description, cli_action* default_action) {
+#ifdef CLI_ENABLE_TRACE
+    trace_init();
+#endif
+    TRACE_BEGIN(start);
+
+    // Initialize the arena allocator. The app owns it and lives inside it.
+    cli_arena* arena = arena_create(CLI_ARENA_CHUNK_SIZE);
+    if (!arena)
+        cli_panic("fatal: failed to initialize memory arena");
+
+    cli_app* app = ARENA_ALLOC(arena, cli_app);
     if (app == NULL)
         return NULL;
 
+    app->arena       = arena;
     app->name        = name;
     app->version     = version;
     app->description = description;
 
-    app->commands      = ARENA_ALLOC_ARRAY(cli_command, MAX_COMMAND_COUNT);
-    app->command_count = 0;
+    app->commands         = NULL;
+    app->command_count    = 0;
+    app->command_capacity = 0;
 
-    app->options      = ARENA_ALLOC_ARRAY(cli_option, MAX_OPTION_COUNT);
-    app->option_count = 0;
+    app->options         = NULL;
+    app->option_count    = 0;
+    app->option_capacity = 0;
 
     app->default_action = default_action;
+#ifndef CLI_NO_THREADS
+    pthread_mutex_init(&app->setup_lock, NULL);
+#endif
+
+#ifdef CLI_ENABLE_TRACE
+    if (TRACE_ACTIVE) {
+        app->trace_created   = trace_now();
+        app->trace_create_ns = app->trace_created - start;
+    }
+#endif
+
+    return app;
+}
+
+cli_app* cli_app_create_static(const cli_app_def* def) {
+#ifdef CLI_ENABLE_TRACE
+    trace_init();
+#endif
+    TRACE_BEGIN(start);
+
+    // Only the app header is mutable (help cache, batch flag), so the arena holds exactly that
+    cli_arena* arena = arena_create(ALIGN_UP(ARENA_BASE, PAGESIZE) + sizeof(cli_app));
+    cli_app* app     = ARENA_ALLOC(arena, cli_app);
+
+    app->arena               = arena;
+    app->name                = def->name;
+    app->version             = def->version;
+    app->description         = def->description;
+    app->default_action      = def->default_action;
+    app->commands            = (cli_command**)def->commands;  // Never written once frozen
+    app->command_count       = def->command_count;
+    app->global_options      = def->options;
+    app->global_option_count = def->option_count;
+    app->batch_enabled       = def->batch_enabled;
+    app->lookup              = def->lookup;
+    app->frozen              = true;
+#ifndef CLI_NO_THREADS
+    pthread_mutex_init(&app->setup_lock, NULL);
+#endif
+
+#ifdef CLI_ENABLE_TRACE
+    if (TRACE_ACTIVE) {
+        app->trace_created   = trace_now();
+        app->trace_create_ns = app->trace_created - start;
+    }
+#endif
 
     return app;
 }
 
+// Static commands keep their help slot across apps
+static void command_release_help(const cli_command* cmd) {
+    free(*cmd->help);
+    *cmd->help = NULL;
+    for (u32 i = 0; i < cmd->child_count; i++) {
+        command_release_help(cmd->children[i]);
+    }
+}
+
 void cli_app_destroy(cli_app* app) {
-    arena_clear(g_arena);
-    arena_destroy(g_arena);
+    for (u32 i = 0; i < app->command_count; i++) {
+        command_release_help(app->commands[i]);
+    }
+    free(app->help);
+    if (app->config != NULL)
+        arena_destroy(app->config->arena);
+#ifndef CLI_NO_THREADS
+    pthread_mutex_destroy(&app->setup_lock);
+#endif
+    arena_destroy(app->arena);
 }
 
 void cli_app_print_info(const cli_app* app) {
     printf("Name: %s\nVersion: %s\nDescription: %s\n", app->name, app->version, app->description);
 }
 
-cli_command* cli_app_add_command(cli_app* app, const char* names, cli_action action, const char* help_text) {
-    if (app->command_count + 1 > MAX_COMMAND_COUNT) {
-        cli_panic("error: maximum command count reached (%d)", MAX_COMMAND_COUNT);
+// Gives `cmd`, then each of its subcommands depth first, its range of the ordered options table
+static u32 freeze_command(cli_command* cmd, cli_option* ordered, u32 start) {
+    cmd->options = ordered + start;
+    start += cmd->option_count;
+    for (u32 i = 0; i < cmd->child_count; i++) {
+        start = freeze_command(cmd->children[i], ordered, start);
+    }
+    return start;
+}
+
+static bool option_is_required(const cli_option* opt) {
+    return opt->required;
+}
+
+static bool option_has_source(const cli_option* opt) {
+    return opt->env != NULL || opt->config_key != NULL;
+}
+
+// Bits over everything `cmd` accepts, set where `test` holds: its own options, then the `inherited_count` its parents
+// accept, whose bits are in `inherited`
+static const u64* freeze_bits(cli_arena* arena,
+                              const cli_command* cmd,
+                              const u64* inherited,
+                              u32 inherited_count,
+                              bool (*test)(const cli_option*)) {
+    u32 count = cmd->option_count + inherited_count;
+    u64* bits = ARENA_ALLOC_ARRAY(arena, u64, BITSET_WORDS(count));
+    for (u32 i = 0; i < cmd->option_count; i++) {
+        if (test(&cmd->options[i]))
+            bits[i / 64] |= 1ull << (i % 64);
+    }
+    for (u32 i = 0, bit = cmd->option_count; i < inherited_count; i++, bit++) {
+        if (inherited[i / 64] & (1ull << (i % 64)))
+            bits[bit / 64] |= 1ull << (bit % 64);
+    }
+    return bits;
+}
+
+// The required and sourced bits of `cmd`, a subcommand of `parent` or top-level if that is NULL, and of every
+// command below it. Also records how many options it inherits, which handles are resolved with.
+static void freeze_option_bits(cli_arena* arena, cli_command* cmd, const cli_command* parent) {
+    u32 inherited_count = parent ? parent->option_count + parent->inherited_option_count : 0;
+    const u64* required = parent ? parent->required : NULL;
+    const u64* sourced  = parent ? parent->sourced : NULL;
+
+    cmd->required               = freeze_bits(arena, cmd, required, inherited_count, option_is_required);
+    cmd->sourced                = freeze_bits(arena, cmd, sourced, inherited_count, option_has_source);
+    cmd->inherited_option_count = inherited_count;
+    for (u32 i = 0; i < cmd->child_count; i++) {
+        freeze_option_bits(arena, cmd->children[i], cmd);
+    }
+}
+
+// Copies the options registered from `first` on into the ranges freeze_command() gave their commands
+static void freeze_options(cli_app* app, u32 first) {
+    for (u32 i = first; i < app->option_count; i++) {
+        const cli_option* opt = &app->options[i];
+        cli_option* list      = (cli_option*)(opt->command ? opt->command->options : app->global_options);
+        list[opt->position]   = *opt;
+    }
+}
+
+void cli_app_freeze(cli_app* app) {
+    if (app->frozen)
+        return;
+
+    // Reorder the options table so each command's options are contiguous: the global options first, then every
+    // command's in turn, each in registration order. Name indices hold positions within these ranges.
+    cli_option* ordered = ARENA_ALLOC_ARRAY(app->arena, cli_option, app->option_count);
+    u32 start           = app->global_option_count;
+    app->global_options = ordered;
+    for (u32 i = 0; i < app->command_count; i++) {
+        start = freeze_command(app->commands[i], ordered, start);
+    }
+
+    freeze_options(app, 0);
+    app->options         = ordered;
+    app->option_capacity = app->option_count;  // Options added by lazy setups go to a new table
+    for (u32 i = 0; i < app->command_count; i++) {
+        freeze_option_bits(app->arena, app->commands[i], NULL);
+    }
+
+#ifdef CLI_ENABLE_TRACE
+    if (TRACE_ACTIVE)
+        app->trace_register_ns = trace_now() - app->trace_created;
+#endif
+    app->frozen = true;
+}
+
+// Runs the setup of lazy command `cmd`, a subcommand of `parent` or top-level if that is NULL, then freezes what it
+// registered as cli_app_freeze() would have. The command is published once it is complete.
+static void command_setup(cli_app* app, const cli_command* parent, cli_command* cmd) {
+    assert(app->frozen);
+#ifndef CLI_NO_THREADS
+    pthread_mutex_lock(&app->setup_lock);
+#endif
+    // Another thread may have run it while this one waited
+    if (cmd->setup != NULL) {
+        u32 first          = app->option_count;
+        app->setup_command = cmd;
+        cmd->setup(app, cmd);
+        app->setup_command = NULL;
+
+        cli_option* ordered = ARENA_ALLOC_ARRAY(app->arena, cli_option, app->option_count - first);
+        freeze_command(cmd, ordered, 0);
+        freeze_options(app, first);
+        freeze_option_bits(app->arena, cmd, parent);
+        __atomic_store_n(&cmd->setup, NULL, __ATOMIC_RELEASE);
+    }
+#ifndef CLI_NO_THREADS
+    pthread_mutex_unlock(&app->setup_lock);
+#endif
+}
+
+static bool command_contains(const cli_command* root, const cli_command* cmd) {
+    if (root == cmd)
+        return true;
+    for (u32 i = 0; i < root->child_count; i++) {
+        if (command_contains(root->children[i], cmd))
+            return true;
     }
+    return false;
+}
+
+// Registration is open until the app is frozen, and then only below the lazy command whose setup is running
+static void registration_check(const cli_app* app, const cli_command* owner, const char* kind, const char* name) {
+    if (!app->frozen)
+        return;
+    if (app->setup_command == NULL)
+        cli_panic("error: cannot add %s '%s' to a frozen app", kind, name);
+    if (owner == NULL || !command_contains(app->setup_command, owner))
+        cli_panic("error: cannot add %s '%s' outside command '%s' from its setup", kind, name,
+                  app->setup_command->names);
+}
+
+cli_command* cli_app_add_command(cli_app* app, const char* names, cli_action action, const char* help_text) {
+    return cli_cmd_add_command(app, NULL, names, action, help_text);
+}
+
+cli_command* cli_cmd_add_command(
+  cli_app* app, cli_command* parent, const char* names, cli_action action, const char* help_text) {
+    registration_check(app, parent, "command", names);
+
+    // Every level has its own table and index, so a lookup only ever sees the commands of one parent
+    cli_command*** cmds   = parent ? &parent->children : &app->commands;
+    u32* count            = parent ? &parent->child_count : &app->command_count;
+    u32* capacity         = parent ? &parent->child_capacity : &app->command_capacity;
+    cli_name_index* index = parent ? &parent->child_index : &app->command_index;
+
+    // Commands are allocated individually so the returned pointer stays valid as the table grows
+    *cmds = (cli_command**)arena_grow_array(app->arena, *cmds, sizeof(cli_command*), *count, capacity);
+
+    u32 cmd_index      = (*count)++;
+    cli_command* cmd   = ARENA_ALLOC(app->arena, cli_command);
+    (*cmds)[cmd_index] = cmd;
 
-    cli_command* cmd = &app->commands[app->command_count++];
-    memset(cmd, 0, sizeof(*cmd));
     cmd->names     = names;
     cmd->action    = action;
     cmd->help_text = help_text;
+    cmd->name_list = split_names(app->arena, names, &cmd->name_count);
+    cmd->help      = ARENA_ALLOC(app->arena, cli_help*);
+
+    for (u32 i = 0; i < cmd->name_count; i++) {
+        name_index_insert(app->arena, index, &cmd->name_list[i], cmd_index);
+    }
+
+    return cmd;
+}
+
+cli_command* cli_app_add_command_ex(cli_app* app, const char* names, cli_action_ex action, const char* help_text) {
+    return cli_cmd_add_command_ex(app, NULL, names, action, help_text);
+}
+
+cli_command* cli_cmd_add_command_ex(
+  cli_app* app, cli_command* parent, const char* names, cli_action_ex action, const char* help_text) {
+    cli_command* cmd = cli_cmd_add_command(app, parent, names, NULL, help_text);
+    cmd->action_ex   = action;
+    return cmd;
+}
+
+cli_command* cli_app_add_command_lazy(cli_app* app, const char* names, cli_setup setup, const char* help_text) {
+    return cli_cmd_add_command_lazy(app, NULL, names, setup, help_text);
+}
 
+cli_command* cli_cmd_add_command_lazy(
+  cli_app* app, cli_command* parent, const char* names, cli_setup setup, const char* help_text) {
+    cli_command* cmd = cli_cmd_add_command(app, parent, names, NULL, help_text);
+    cmd->setup       = setup;
     return cmd;
 }
 
-void cli_app_add_option(cli_app* app, const char* names, bool required, bool is_flag, const char* help_text) {
+cli_opt cli_app_add_option(cli_app* app, const char* names, bool required, bool is_flag, const char* help_text) {
     // Global options just have NULL commands (uses app's default_action)
-    cli_cmd_add_option(app, NULL, names, required, is_flag, help_text);
+    return cli_cmd_add_option(app, NULL, names, required, is_flag, help_text);
 }
 
-void cli_cmd_add_option(
+cli_opt cli_cmd_add_option(
   cli_app* app, cli_command* cmd, const char* names, bool required, bool is_flag, const char* help_text) {
-    if (app->option_count + 1 > MAX_OPTION_COUNT) {
-        cli_panic("error: maximum option count reached (%d)", MAX_OPTION_COUNT);
-    }
+    registration_check(app, cmd, "option", names);
+
+    app->options = (cli_option*)arena_grow_array(
+      app->arena, app->options, sizeof(cli_option), app->option_count, &app->option_capacity);
 
-    cli_option* opt = &app->options[app->option_count++];
+    u32 opt_index   = app->option_count++;
+    cli_option* opt = &app->options[opt_index];
     memset(opt, 0, sizeof(*opt));
     opt->command   = cmd;
     opt->help_text = help_text;
     opt->is_flag   = is_flag;
     opt->required  = required;
     opt->names     = names;
+    opt->name_list = split_names(app->arena, names, &opt->name_count);
+    opt->position  = cmd ? cmd->option_count++ : app->global_option_count++;
+
+    cli_name_index* index = cmd ? &cmd->option_index : &app->option_index;
+    for (u32 i = 0; i < opt->name_count; i++) {
+        name_index_insert(app->arena, index, &opt->name_list[i], opt->position);
+    }
+
+    return (cli_opt){cmd, opt->position};
+}
+
+cli_opt cli_app_add_typed_option(
+  cli_app* app, const char* names, bool required, const cli_option_type* type, const char* help_text) {
+    return cli_cmd_add_typed_option(app, NULL, names, required, type, help_text);
+}
+
+cli_opt cli_cmd_add_typed_option(cli_app* app,
+                                 cli_command* cmd,
+                                 const char* names,
+                                 bool required,
+                                 const cli_option_type* type,
+                                 const char* help_text) {
+    if (type->type == CLI_TYPE_ENUM && type->choice_count == 0)
+        cli_panic("error: option '%s' is an enum without choices", names);
+    if (type->min > type->max)
+        cli_panic("error: option '%s' has an empty range [%ld, %ld]", names, type->min, type->max);
+
+    cli_opt handle    = cli_cmd_add_option(app, cmd, names, required, false, help_text);
+    cli_option* opt   = &app->options[app->option_count - 1];
+    opt->type         = (u8)type->type;
+    opt->min          = type->min;
+    opt->max          = type->max;
+    opt->choices      = type->choices;
+    opt->choice_count = type->choice_count;
+    return handle;
+}
+
+void cli_app_set_option_source(cli_app* app, cli_opt handle, const char* env, const char* config_key) {
+    registration_check(app, handle.command, "source", env ? env : config_key ? config_key : "");
+
+    // Usually the option just added, so the search stops at once
+    for (u32 i = app->option_count; i-- > 0;) {
+        cli_option* opt = &app->options[i];
+        if (opt->command == handle.command && opt->position == handle.position) {
+            opt->env        = env;
+            opt->config_key = config_key;
+            return;
+        }
+    }
+    cli_panic("error: no option %u in '%s'", handle.position, handle.command ? handle.command->names : app->name);
+}
+
+void cli_app_set_config(cli_app* app, const char* path) {
+    if (app->config != NULL)
+        arena_destroy(app->config->arena);
+    app->config      = NULL;
+    app->config_path = path;
+}
+
+cli_opt cli_app_find_option(const cli_app* app, const char* command, const char* name) {
+    if (!app->frozen)
+        cli_panic("error: cli_app_find_option() requires a frozen app, call cli_app_freeze() first");
+
+    const cli_command* cmd = NULL;
+    for (const char* word = command; word != NULL && *word != '\0';) {
+        size_t len = strcspn(word, " ");
+        cmd        = len > 0 ? find_command(app, cmd, word, len) : cmd;
+        if (cmd == NULL)
+            cli_panic("error: no command '%s' in '%s'", command, app->name);
+        word += len + (word[len] == ' ');
+    }
+
+    size_t len             = strlen(name);
+    const cli_option* opt  = find_option_hashed(app, cmd, name, len, cli_hash_name(name, len));
+    const cli_option* defs = cmd ? cmd->options : app->global_options;
+    if (opt == NULL)
+        cli_panic("error: no option '%s' in '%s%s%s'", name, app->name, cmd ? " " : "", cmd ? command : "");
+    return (cli_opt){cmd, (u32)(opt - defs)};
 }
 
 /*********************************************************************/
-/* Argument Parsing                                                  */
+/* Typed values                                                      */
 /*********************************************************************/
 
-static int parse_command_args(cli_app* app, cli_command* cmd, int argc, char* argv[], int start_index) {
-    u32 opt_count;
-    cli_option** opts = get_command_options(app, cmd, &opt_count);
+// Integer conversions tell values that don't fit apart from malformed ones, which are reported differently
+typedef enum {
+    CONVERT_OK,
+    CONVERT_INVALID,
+    CONVERT_OVERFLOW,
+} convert_status;
 
-    // Reset all options to defaults
-    for (u32 i = 0; i < opt_count; i++) {
-        opts[i]->is_present = false;
-        memset(opts[i]->value, 0, sizeof(opts[i]->value));
+// Plain decimal digits, stopping at the first other character
+static convert_status convert_digits(const char** cursor, const char* end, u64* out) {
+    const char* c = *cursor;
+    u64 value     = 0;
+    bool overflow = false;
+    for (; c < end; c++) {
+        u32 digit = (u32)(u8)*c - '0';
+        if (digit > 9)
+            break;
+        overflow |= __builtin_mul_overflow(value, 10, &value);
+        overflow |= __builtin_add_overflow(value, digit, &value);
     }
 
-    int idx = start_index;
-    while (idx < argc) {
-        const char* arg = argv[idx];
-
-        if (STREQ(arg, "--help") || STREQ(arg, "-h")) {
-            print_command_help(app, cmd, opts, &opt_count);
-            return 0;
-        }
+    convert_status status = c == *cursor ? CONVERT_INVALID : overflow ? CONVERT_OVERFLOW : CONVERT_OK;
+    *cursor               = c;
+    *out                  = value;
+    return status;
+}
 
-        if (!is_option_arg(arg)) {
-            fprintf(stderr, "error: unexpected argument '%s'\n", arg);
-            return 1;
-        }
+static convert_status convert_int(const char* str, const char* end, i64* out) {
+    bool negative = str < end && *str == '-';
+    str += str < end && (*str == '-' || *str == '+');
 
-        cli_option* opt = find_option_from_list(opts, opt_count, arg);
-        if (opt == NULL) {
-            fprintf(stderr, "error: unknown option '%s'\n", arg);
-            return 1;
-        }
+    u64 magnitude;
+    convert_status status = convert_digits(&str, end, &magnitude);
+    if (status == CONVERT_INVALID || str != end)
+        return CONVERT_INVALID;
+    if (status == CONVERT_OVERFLOW || magnitude > (u64)INT64_MAX + negative)
+        return CONVERT_OVERFLOW;
 
-        opt->is_present = true;
+    *out = negative ? -(i64)(magnitude - 1) - 1 : (i64)magnitude;
+    return CONVERT_OK;
+}
 
-        if (opt->is_flag) {
-            strcpy(opt->value, "true");
-        } else {
-            idx++;
-            if (idx >= argc) {
-                fprintf(stderr, "error: option '%s' requires a value\n", arg);
-                return 1;
-            }
+// Mantissa and exponent are gathered as integers. Up to 2^53 * 10^22 the result is one exact multiplication or
+// division (Clinger's fast path); beyond that it is scaled in long double, close enough for command-line input.
+static bool convert_double(const char* str, const char* end, double* out) {
+    static const double exact[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
 
-            const char* value = argv[idx];
-            if (is_option_arg(value)) {
-                fprintf(stderr, "error: option '%s' requires a value, got '%s'\n", arg, value);
-                return 1;
-            }
+    bool negative = str < end && *str == '-';
+    str += str < end && (*str == '-' || *str == '+');
 
-            size_t len = strlen(value);
-            if (len >= sizeof(opt->value)) {
-                fprintf(stderr, "error: value for '%s' is too long (max %zu)\n", arg, sizeof(opt->value) - 1);
-                return 1;
-            }
+    u64 mantissa  = 0;
+    i64 exponent  = 0;
+    bool digits   = false;
+    bool fraction = false;
+    for (; str < end; str++) {
+        u32 digit = (u32)(u8)*str - '0';
+        if (digit > 9) {
+            if (*str != '.' || fraction)
+                break;
+            fraction = true;
+            continue;
+        }
 
-            memcpy(opt->value, value, len + 1);
+        // Digits past what a u64 holds only move the decimal point
+        digits = true;
+        if (mantissa < UINT64_MAX / 10 - 1) {
+            mantissa = mantissa * 10 + digit;
+            exponent -= fraction;
+        } else {
+            exponent += !fraction;
         }
+    }
+    if (!digits)
+        return false;
 
-        idx++;
+    if (str < end && (*str == 'e' || *str == 'E')) {
+        i64 shift;
+        str++;
+        if (convert_int(str, end, &shift) != CONVERT_OK || shift < -100000 || shift > 100000)
+            return false;
+        exponent += shift;
+        str = end;
     }
+    if (str != end)
+        return false;
 
-    for (u32 i = 0; i < opt_count; i++) {
-        if (opts[i]->required && !opts[i]->is_present) {
-            fprintf(stderr, "error: required option '%s' not provided\n", opts[i]->names);
-            return 1;
+    double value;
+    if (mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22) {
+        value = exponent < 0 ? (double)mantissa / exact[-exponent] : (double)mantissa * exact[exponent];
+    } else {
+        long double scale = 1, base = 10;
+        for (u64 n = (u64)(exponent < 0 ? -exponent : exponent); n != 0; n >>= 1, base *= base) {
+            if (n & 1)
+                scale *= base;
         }
+        value = (double)(exponent < 0 ? mantissa / scale : mantissa * scale);
     }
+    if (!__builtin_isfinite(value))
+        return false;
 
-    return cmd->action(opts, opt_count);
+    *out = negative ? -value : value;
+    return true;
 }
 
-int cli_app_run(cli_app* app, const i32 argc, char** argv) {
-    if (argc < 2) {
-        if (app->command_count == 0) {
-            if (app->default_action != NULL) {
-                return (*(app->default_action))(NULL, 0);
-            }
+static bool convert_bool(const char* str, size_t len, bool* out) {
+    static const char* const words[] = {"false", "true", "no", "yes", "off", "on", "0", "1"};
+    for (u32 i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        if (strlen(words[i]) == len && memcmp(words[i], str, len) == 0) {
+            *out = i & 1;
+            return true;
         }
-        print_app_help(app);
-        return 1;
     }
+    return false;
+}
 
-    const char* first_arg = argv[1];
+static bool convert_choice(const cli_option* opt, const char* str, size_t len, u32* out) {
+    for (u32 i = 0; i < opt->choice_count; i++) {
+        if (strlen(opt->choices[i]) == len && memcmp(opt->choices[i], str, len) == 0) {
+            *out = i;
+            return true;
+        }
+    }
+    return false;
+}
 
-    if (STREQ(first_arg, "--help") || STREQ(first_arg, "-h")) {
-        print_app_help(app);
-        return 0;
+// "64M", "64MB" and "64MiB" are all 64 << 20
+static convert_status convert_size(const char* str, const char* end, u64* out) {
+    static const u8 shift[256] = {['K'] = 10, ['k'] = 10, ['M'] = 20, ['G'] = 30, ['T'] = 40, ['P'] = 50, ['E'] = 60};
+
+    u64 value;
+    convert_status status = convert_digits(&str, end, &value);
+    if (status == CONVERT_INVALID)
+        return CONVERT_INVALID;
+
+    u32 bits = str < end ? shift[(u8)*str] : 0;
+    str += bits != 0;
+    if (bits != 0 && end - str == 2 && str[0] == 'i')
+        str++;
+    str += str < end && *str == 'B';
+    if (str != end)
+        return CONVERT_INVALID;
+    if (status == CONVERT_OVERFLOW || value > UINT64_MAX >> bits)
+        return CONVERT_OVERFLOW;
+
+    *out = value << bits;
+    return CONVERT_OK;
+}
+
+// A sum of <digits><unit> parts, e.g. "1h30m". A bare 0 needs no unit.
+static convert_status convert_duration(const char* str, const char* end, i64* out) {
+    static const struct {
+        char name[3];
+        u64 ns;
+    } units[] = {{"ns", 1}, {"us", 1000}, {"ms", 1000000}, {"s", 1000000000ull}, {"m", 60000000000ull},
+                 {"h", 3600000000000ull}, {"d", 86400000000000ull}};
+
+    if (end - str == 1 && *str == '0') {
+        *out = 0;
+        return CONVERT_OK;
     }
 
-    else if (STREQ(first_arg, "--version") || STREQ(first_arg, "-v")) {
-        printf("%s %s\n", app->name, app->version);
+    // Overflow is only reported once the whole value has been checked
+    u64 total     = 0;
+    bool overflow = false;
+    do {
+        u64 count;
+        convert_status status = convert_digits(&str, end, &count);
+        if (status == CONVERT_INVALID)
+            return CONVERT_INVALID;
+        overflow |= status == CONVERT_OVERFLOW;
+
+        const char* unit = str;
+        while (str < end && (u32)(u8)*str - '0' > 9)
+            str++;
+
+        size_t unit_len = (size_t)(str - unit);
+        u32 i           = 0;
+        while (i < sizeof(units) / sizeof(units[0]) &&
+               (strlen(units[i].name) != unit_len || memcmp(units[i].name, unit, unit_len) != 0))
+            i++;
+        if (i == sizeof(units) / sizeof(units[0]))
+            return CONVERT_INVALID;
+        overflow |= __builtin_mul_overflow(count, units[i].ns, &count);
+        overflow |= __builtin_add_overflow(total, count, &total);
+    } while (str < end);
+
+    if (overflow || total > INT64_MAX)
+        return CONVERT_OVERFLOW;
+
+    *out = (i64)total;
+    return CONVERT_OK;
+}
+
+static const char* const convert_expected[] = {
+    [CLI_TYPE_INT]      = "an integer",
+    [CLI_TYPE_DOUBLE]   = "a number",
+    [CLI_TYPE_BOOL]     = "true or false",
+    [CLI_TYPE_ENUM]     = "one of",
+    [CLI_TYPE_SIZE]     = "a size such as 512K or 64M",
+    [CLI_TYPE_DURATION] = "a duration such as 250ms or 1h30m",
+    [CLI_TYPE_PATH]     = "a path",
+};
+
+// Range of each integer type when the option sets none, for values that don't fit it
+static const char* const convert_limits[] = {
+    [CLI_TYPE_INT]      = "-9223372036854775808, 9223372036854775807",
+    [CLI_TYPE_SIZE]     = "0, 18446744073709551615",
+    [CLI_TYPE_DURATION] = "0, 9223372036854775807ns",
+};
+
+// Integer types are compared as integers, so bounds near the 64-bit limits stay exact
+static bool option_in_range(const cli_option* opt) {
+    switch ((cli_type)opt->type) {
+    case CLI_TYPE_INT:
+        return opt->as.integer >= opt->min && opt->as.integer <= opt->max;
+    case CLI_TYPE_DOUBLE:
+        return opt->as.real >= (double)opt->min && opt->as.real <= (double)opt->max;
+    case CLI_TYPE_SIZE:
+        return (opt->min <= 0 || opt->as.bytes >= (u64)opt->min) && opt->max >= 0 && opt->as.bytes <= (u64)opt->max;
+    case CLI_TYPE_DURATION:
+        return opt->as.nanoseconds >= opt->min && opt->as.nanoseconds <= opt->max;
+    default:
+        return true;
     }
+}
 
-    cli_command* cmd = find_command(app, first_arg);
-    if (cmd == NULL) {
-        if (app->default_action != NULL) {
-            // Parse options for default action
-            u32 opt_count;
-            cli_option** opts = get_command_options(app, NULL, &opt_count);
-            cli_action def    = *(app->default_action);
-            return def(opts, opt_count);
+// Convert `value` to the option's type into `opt->as`. `name` is the option as written, for error messages.
+static bool option_convert(cli_option* opt, const char* name, size_t name_len, const char* value, size_t len) {
+    const char* end       = value + len;
+    bool ok               = false;
+    convert_status status = CONVERT_OK;  // Set by the integer types
+    switch ((cli_type)opt->type) {
+    case CLI_TYPE_STRING:
+        return true;
+    case CLI_TYPE_INT:
+        status = convert_int(value, end, &opt->as.integer);
+        ok     = status != CONVERT_INVALID;
+        break;
+    case CLI_TYPE_DOUBLE:
+        ok = convert_double(value, end, &opt->as.real);
+        break;
+    case CLI_TYPE_BOOL:
+        ok = convert_bool(value, len, &opt->as.boolean);
+        break;
+    case CLI_TYPE_ENUM:
+        ok = convert_choice(opt, value, len, &opt->as.choice);
+        break;
+    case CLI_TYPE_SIZE:
+        status = convert_size(value, end, &opt->as.bytes);
+        ok     = status != CONVERT_INVALID;
+        break;
+    case CLI_TYPE_DURATION:
+        status = convert_duration(value, end, &opt->as.nanoseconds);
+        ok     = status != CONVERT_INVALID;
+        break;
+    case CLI_TYPE_PATH:
+        ok = len > 0;
+        break;
+    }
+
+    FILE* err = cli_stderr();
+    if (!ok) {
+        fprintf(err, "error: invalid value '%s' for '%.*s', expected %s", value, (int)name_len, name,
+                convert_expected[opt->type]);
+        for (u32 i = 0; opt->type == CLI_TYPE_ENUM && i < opt->choice_count; i++) {
+            fprintf(err, "%s%s", i ? ", " : " ", opt->choices[i]);
         }
+        fprintf(err, "\n");
+        return false;
+    }
 
-        fprintf(stderr, "error: unknown command '%s'\n", first_arg);
-        print_app_help(app);
-        return 1;
+    if (status == CONVERT_OVERFLOW && opt->min == opt->max) {
+        fprintf(err, "error: value '%s' for '%.*s' is out of range [%s]\n", value, (int)name_len, name,
+                convert_limits[opt->type]);
+        return false;
+    }
+    if (opt->min != opt->max && (status == CONVERT_OVERFLOW || !option_in_range(opt))) {
+        fprintf(err, "error: value '%s' for '%.*s' is out of range [%ld, %ld]\n", value, (int)name_len, name, opt->min,
+                opt->max);
+        return false;
     }
 
-    return parse_command_args(app, cmd, argc, argv, 2);
+    return true;
 }
 
-// Remove macro definitions to avoid conflicts with files that include this header
-#undef ARENA_BASE
-#undef ALIGN_UP
-#undef KB
-#undef MB
-#undef PAGESIZE
+/*********************************************************************/
+/* Suggestions                                                       */
+/*********************************************************************/
+
+// How many names are offered for a mistyped command or option, and how many edits away they may be
+#ifndef CLI_SUGGEST_MAX
+    #define CLI_SUGGEST_MAX 3
+#endif
+#ifndef CLI_SUGGEST_DISTANCE
+    #define CLI_SUGGEST_DISTANCE 3
+#endif
+
+// The mistyped word as a bit-vector pattern, and the closest names found so far
+typedef struct {
+    u64 peq[256];  // Bit i of peq[c] is set if character i of the word is c
+    const char* word;
+    u32 len;
+    u32 stem;          // Leading dashes, skipped by the first-letter filter
+    u32 max_distance;  // Tightens once `names` is full
+    u32 count;
+    const cli_name* names[CLI_SUGGEST_MAX];  // Closest first, earlier registrations first among equals
+    u32 distances[CLI_SUGGEST_MAX];
+} suggest_state;
+
+static bool suggest_init(suggest_state* s, const char* word, size_t len) {
+    size_t stem = strspn(word, "-");
+    if (len <= stem || len > 64)
+        return false;
+
+    memset(s->peq, 0, sizeof(s->peq));
+    for (u32 i = 0; i < len; i++) {
+        s->peq[(u8)word[i]] |= 1ull << i;
+    }
+    s->word  = word;
+    s->len   = (u32)len;
+    s->stem  = (u32)stem;
+    s->count = 0;
+    // Short words allow fewer edits, or every short name would be offered
+    s->max_distance = MIN((u32)CLI_SUGGEST_DISTANCE, (u32)(len - stem + 1) / 2);
+    return true;
+}
+
+// Edit distance between the word and `text`, or UINT32_MAX once it can no longer be `max` or less. Myers'
+// bit-parallel algorithm in Hyyrö's form for whole strings: each text character computes a column of the distance
+// matrix as vertical deltas, one bit per character of the word.
+static u32 suggest_distance(const suggest_state* s, const char* text, u32 len, u32 max) {
+    u64 pv = ~0ull, mv = 0, last = 1ull << (s->len - 1);
+    u32 score = s->len;
+    for (u32 j = 0; j < len; j++) {
+        u64 eq = s->peq[(u8)text[j]];
+        u64 xv = eq | mv;
+        u64 xh = (((eq & pv) + pv) ^ pv) | eq;
+        u64 ph = mv | ~(xh | pv);
+        u64 mh = pv & xh;
+        score += (ph & last) != 0;
+        score -= (mh & last) != 0;
+        // Each remaining character lowers the score by one at most
+        if (score > max + (len - j - 1))
+            return UINT32_MAX;
+        ph = (ph << 1) | 1;
+        mh <<= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+    }
+    return score <= max ? score : UINT32_MAX;
+}
+
+// Consider every name of one command or option, and keep the closest of them
+static void suggest_names(suggest_state* s, const cli_name* names, u32 count) {
+    const cli_name* best = NULL;
+    u32 distance         = s->max_distance;
+    for (u32 i = 0; i < count; i++) {
+        const cli_name* name = &names[i];
+        if (name->len + distance < s->len || s->len + distance < name->len)
+            continue;
+        u32 stem = 0;
+        while (stem < name->len && name->str[stem] == '-')
+            stem++;
+        if (stem == name->len)
+            continue;
+
+        // The first letters must match, possibly swapped with or shifted by the second
+        const char* a = s->word + s->stem;
+        const char* b = name->str + stem;
+        u32 a_len = s->len - s->stem, b_len = name->len - stem;
+        if (a[0] != b[0] && !(a_len > 1 && a[1] == b[0]) && !(b_len > 1 && a[0] == b[1]))
+            continue;
+
+        u32 d = suggest_distance(s, name->str, name->len, distance);
+        if (d != UINT32_MAX && (best == NULL || d < distance)) {
+            best     = name;
+            distance = d;
+        }
+    }
+    if (best == NULL)
+        return;
+
+    u32 i = MIN(s->count, (u32)CLI_SUGGEST_MAX - 1);
+    for (; i > 0 && s->distances[i - 1] > distance; i--) {
+        s->names[i]     = s->names[i - 1];
+        s->distances[i] = s->distances[i - 1];
+    }
+    s->names[i]     = best;
+    s->distances[i] = distance;
+    s->count        = MIN(s->count + 1, (u32)CLI_SUGGEST_MAX);
+    // Once the list is full only strictly closer names can get in
+    if (s->count == CLI_SUGGEST_MAX && s->distances[CLI_SUGGEST_MAX - 1] > 0)
+        s->max_distance = s->distances[CLI_SUGGEST_MAX - 1] - 1;
+}
+
+// "did you mean 'a', 'b' or 'c'?". False if nothing was close enough.
+static bool suggest_print(FILE* err, const suggest_state* s) {
+    if (s->count == 0)
+        return false;
+
+    fprintf(err, "did you mean ");
+    for (u32 i = 0; i < s->count; i++) {
+        const char* sep = i == 0 ? "" : i + 1 < s->count ? ", " : " or ";
+        fprintf(err, "%s'%.*s'", sep, (int)s->names[i]->len, s->names[i]->str);
+    }
+    fprintf(err, "?\n");
+    return true;
+}
+
+// Offer the subcommands of `parent`, or the top-level commands, closest to `word`
+static bool suggest_command(const cli_app* app, const cli_command* parent, const char* word, FILE* err) {
+    suggest_state s;
+    if (!suggest_init(&s, word, strlen(word)))
+        return false;
+
+    cli_command* const* cmds = parent ? parent->children : app->commands;
+    u32 count                = parent ? parent->child_count : app->command_count;
+    for (u32 i = 0; i < count; i++) {
+        suggest_names(&s, cmds[i]->name_list, cmds[i]->name_count);
+    }
+    return suggest_print(err, &s);
+}
+
+// Offer the options accepted on `path` closest to `word`, which needs no terminator. Same scope as find_path_option().
+static bool suggest_option(const cli_app* app, const command_path* path, const char* word, size_t len, FILE* err) {
+    suggest_state s;
+    if (!suggest_init(&s, word, len))
+        return false;
+
+    for (u32 level = path->depth; level-- > 0;) {
+        const cli_command* cmd = path->items[level];
+        for (u32 i = 0; i < cmd->option_count; i++) {
+            suggest_names(&s, cmd->options[i].name_list, cmd->options[i].name_count);
+        }
+    }
+    for (u32 i = 0; path->depth == 0 && i < app->global_option_count; i++) {
+        suggest_names(&s, app->global_options[i].name_list, app->global_options[i].name_count);
+    }
+    return suggest_print(err, &s);
+}
+
+/*********************************************************************/
+/* Argument Parsing                                                  */
+/*********************************************************************/
+
+// The values array grows whenever its count reaches a power of two, so no capacity needs to be stored
+static void option_push_value(cli_arena* arena, cli_option* opt, const char* value) {
+    u32 count = opt->value_count;
+    if ((count & (count - 1)) == 0) {
+        const char** values = (const char**)arena_push(arena, sizeof(const char*) * (count ? count * 2 : 1), true);
+        if (count > 0)
+            memcpy(values, opt->values, sizeof(const char*) * count);
+        TRACE_COUNT(bytes_copied, sizeof(const char*) * count);
+        opt->values = values;
+    }
+    opt->values[opt->value_count++] = value;
+}
+
+static void parse_exit(cli_parse_result* result, cli_parse_status status, i32 exit_code) {
+    result->status    = status;
+    result->exit_code = exit_code;
+}
+
+// Sets a flag, or a value option to `value` if given inline ("--name=value", "-xVALUE"), else to the next argument.
+// `name` is the option as written, for error messages.
+static bool option_parse_value(cli_arena* arena,
+                               cli_option* opt,
+                               const char* name,
+                               size_t name_len,
+                               const char* value,
+                               int argc,
+                               char* argv[],
+                               int* idx) {
+    FILE* err = cli_stderr();
+    if (opt->is_flag) {
+#ifdef CLI_INLINE_VALUE
+        memcpy(opt->value, "true", sizeof("true"));
+#else
+        opt->value = "true";
+#endif
+        opt->value_len  = sizeof("true") - 1;
+        opt->as.boolean = true;
+        return true;
+    }
+
+    if (value == NULL) {
+        if (++*idx >= argc) {
+            fprintf(err, "error: option '%.*s' requires a value\n", (int)name_len, name);
+            return false;
+        }
+
+        // "-1" is a value, not an option, when a number is expected
+        value        = argv[*idx];
+        bool numeric = opt->type == CLI_TYPE_INT || opt->type == CLI_TYPE_DOUBLE;
+        if (is_option_arg(value) && !(numeric && ((u32)(u8)value[1] - '0' <= 9 || value[1] == '.'))) {
+            fprintf(err, "error: option '%.*s' requires a value, got '%s'\n", (int)name_len, name, value);
+            return false;
+        }
+    }
+
+    size_t len = strlen(value);
+#ifdef CLI_INLINE_VALUE
+    if (len >= sizeof(opt->value)) {
+        fprintf(err, "error: value for '%.*s' is too long (max %zu)\n", (int)name_len, name, sizeof(opt->value) - 1);
+        return false;
+    }
+
+    memcpy(opt->value, value, len + 1);
+    TRACE_COUNT(bytes_copied, len + 1);
+#else
+    opt->value = value;
+#endif
+    opt->value_len = (u32)len;
+    option_push_value(arena, opt, value);
+    return option_convert(opt, name, name_len, value, len);
+}
+
+// Fill in an option missing from the command line from its environment variable or, failing that, its config key.
+// It stays missing if neither is set.
+static bool option_resolve(const cli_app* app, cli_arena* arena, cli_option** opts, u64* present, u32 position) {
+    const cli_option* def = opts[position];
+    const char* source    = def->env;
+    const char* value     = def->env ? getenv(def->env) : NULL;
+    if (value == NULL && def->config_key != NULL) {
+        source = def->config_key;
+        value  = config_find(app, def->config_key);
+    }
+    if (value == NULL)
+        return true;
+
+    // A flag is given by a true value and left out by a false one
+    bool given = true;
+    if (def->is_flag && !convert_bool(value, strlen(value), &given)) {
+        fprintf(cli_stderr(), "error: invalid value '%s' for '%s', expected %s\n", value, source,
+                convert_expected[CLI_TYPE_BOOL]);
+        return false;
+    }
+    if (!given)
+        return true;
+
+    int idx = 0;
+    return option_parse_value(arena, option_given(arena, opts, present, position), source, strlen(source), value, 0,
+                              NULL, &idx);
+}
+
+// "-lwc" is "-l -w -c". The first value option in a bundle takes the rest of it as its value ("-vpfile"), or the
+// next argument if it comes last. Each letter is looked up as a two-byte name.
+static bool parse_short_bundle(const cli_app* app,
+                               cli_arena* arena,
+                               const command_path* path,
+                               cli_option** opts,
+                               u64* present,
+                               int argc,
+                               char* argv[],
+                               int* idx) {
+    const char* arg = argv[*idx];
+    for (const char* c = arg + 1; *c != '\0'; c++) {
+        char name[2] = {'-', *c};
+        u32 position;
+        if (find_path_option(app, path, name, sizeof(name), &position) == NULL) {
+            fprintf(cli_stderr(), "error: unknown option '-%c' in '%s'\n", *c, arg);
+            return false;
+        }
+
+        cli_option* opt   = option_given(arena, opts, present, position);
+        const char* value = !opt->is_flag && c[1] != '\0' ? c + 1 : NULL;
+        if (!option_parse_value(arena, opt, name, sizeof(name), value, argc, argv, idx))
+            return false;
+        if (!opt->is_flag)
+            break;
+    }
+    return true;
+}
+
+static void parse_command_args(const cli_app* app,
+                               cli_arena* arena,
+                               const command_path* path,
+                               int argc,
+                               char* argv[],
+                               int start_index,
+                               cli_parse_result* result) {
+    FILE* err              = cli_stderr();
+    const cli_command* cmd = path->items[path->depth - 1];
+    u32 opt_count;
+    cli_option** opts = get_option_values(app, path, arena, &opt_count);
+    u64* present      = (u64*)arena_push(arena, sizeof(u64) * BITSET_WORDS(opt_count), false);
+
+    result->command      = cmd;
+    result->options      = opts;
+    result->option_count = opt_count;
+    result->present      = present;
+
+    for (int idx = start_index; idx < argc; idx++) {
+        const char* arg = argv[idx];
+        token_kind kind = lex_token(arg);
+
+        if (kind == TOKEN_END) {
+            result->args      = argv + idx + 1;
+            result->arg_count = (u32)(argc - idx - 1);
+            break;
+        }
+
+        if (kind == TOKEN_WORD) {
+            fprintf(err, "error: unexpected argument '%s'\n", arg);
+            return parse_exit(result, CLI_PARSE_ERROR, 1);
+        }
+
+        if (STREQ(arg, "--help") || STREQ(arg, "-h")) {
+            print_command_help(app, path);
+            return parse_exit(result, CLI_PARSE_EXIT, 0);
+        }
+
+        // The whole token first, so names like "-o1" are never taken for a bundle. Then "name=value", split by
+        // viewing both halves in place.
+        size_t len          = strlen(arg);
+        const char* value   = NULL;
+        const char* equals  = memchr(arg, '=', len);
+        u32 position;
+        const cli_option* def = find_path_option(app, path, arg, len, &position);
+        if (def == NULL && equals != NULL) {
+            len   = (size_t)(equals - arg);
+            value = equals + 1;
+            def   = find_path_option(app, path, arg, len, &position);
+        }
+
+        if (def == NULL && kind == TOKEN_SHORT && arg[2] != '\0') {
+            if (!parse_short_bundle(app, arena, path, opts, present, argc, argv, &idx))
+                return parse_exit(result, CLI_PARSE_ERROR, 1);
+            continue;
+        }
+
+        if (def == NULL) {
+            fprintf(err, "error: unknown option '%.*s'\n", (int)len, arg);
+            suggest_option(app, path, arg, len, err);
+            return parse_exit(result, CLI_PARSE_ERROR, 1);
+        }
+
+        cli_option* opt = option_given(arena, opts, present, position);
+        if (opt->is_flag && value != NULL) {
+            fprintf(err, "error: option '%.*s' does not take a value\n", (int)len, arg);
+            return parse_exit(result, CLI_PARSE_ERROR, 1);
+        }
+        if (!option_parse_value(arena, opt, arg, len, value, argc, argv, &idx))
+            return parse_exit(result, CLI_PARSE_ERROR, 1);
+    }
+
+    // A command that only groups subcommands has nothing to run
+    if (cmd->action == NULL && cmd->action_ex == NULL) {
+        print_command_help(app, path);
+        return parse_exit(result, CLI_PARSE_EXIT, 1);
+    }
+
+    // Options left out fall back to their sources. Only the ones that have a source are looked at, so a command line
+    // that gives them all never reads the environment or the config file.
+    for (u32 w = 0; cmd->sourced != NULL && w < BITSET_WORDS(opt_count); w++) {
+        for (u64 missing = cmd->sourced[w] & ~present[w]; missing != 0; missing &= missing - 1) {
+            if (!option_resolve(app, arena, opts, present, w * 64 + __builtin_ctzll(missing)))
+                return parse_exit(result, CLI_PARSE_ERROR, 1);
+        }
+    }
+    for (u32 i = 0; cmd->sourced == NULL && i < opt_count; i++) {
+        if (!opts[i]->is_present && option_has_source(opts[i]) && !option_resolve(app, arena, opts, present, i))
+            return parse_exit(result, CLI_PARSE_ERROR, 1);
+    }
+
+    // 64 options per compare. The first missing option is reported, as the per-option check does.
+    for (u32 w = 0; cmd->required != NULL && w < BITSET_WORDS(opt_count); w++) {
+        u64 missing = cmd->required[w] & ~present[w];
+        if (missing != 0) {
+            fprintf(err, "error: required option '%s' not provided\n", opts[w * 64 + __builtin_ctzll(missing)]->names);
+            return parse_exit(result, CLI_PARSE_ERROR, 1);
+        }
+    }
+    for (u32 i = 0; cmd->required == NULL && i < opt_count; i++) {
+        if (opts[i]->required && !opts[i]->is_present) {
+            fprintf(err, "error: required option '%s' not provided\n", opts[i]->names);
+            return parse_exit(result, CLI_PARSE_ERROR, 1);
+        }
+    }
+
+    parse_exit(result, CLI_PARSE_OK, 0);
+}
+
+static void parse_invocation(
+  const cli_app* app, cli_arena* arena, const i32 argc, char** argv, cli_parse_result* result) {
+    if (argc < 2) {
+        if (app->command_count == 0) {
+            if (app->default_action != NULL) {
+                return parse_exit(result, CLI_PARSE_OK, 0);
+            }
+        }
+        print_app_help(app);
+        return parse_exit(result, CLI_PARSE_EXIT, 1);
+    }
+
+    const char* first_arg = argv[1];
+
+    if (STREQ(first_arg, "--help") || STREQ(first_arg, "-h")) {
+        print_app_help(app);
+        return parse_exit(result, CLI_PARSE_EXIT, 0);
+    }
+
+    else if (STREQ(first_arg, "--version") || STREQ(first_arg, "-v")) {
+        fprintf(cli_stdout(), "%s %s\n", app->name, app->version);
+        return parse_exit(result, CLI_PARSE_EXIT, 0);
+    }
+
+    const cli_command* cmd = find_command(app, NULL, first_arg, strlen(first_arg));
+    command_path path      = {{cmd}, 1};
+    if (cmd == NULL) {
+        if (app->default_action != NULL) {
+            // Parse options for default action
+            path.depth      = 0;
+            result->options = get_option_values(app, &path, arena, &result->option_count);
+            return parse_exit(result, CLI_PARSE_OK, 0);
+        }
+
+        // The help lists every command, so it is only shown when none is close
+        fprintf(cli_stderr(), "error: unknown command '%s'\n", first_arg);
+        if (!suggest_command(app, NULL, first_arg, cli_stderr()))
+            print_app_help(app);
+        return parse_exit(result, CLI_PARSE_ERROR, 1);
+    }
+
+    // Arguments up to the first option name subcommands, one level each
+    int idx = 2;
+    while (idx < argc && cmd->child_count > 0 && path.depth < CLI_MAX_DEPTH && !is_option_arg(argv[idx])) {
+        cmd = find_command(app, cmd, argv[idx], strlen(argv[idx]));
+        if (cmd == NULL) {
+            fprintf(cli_stderr(), "error: unknown command '%s'\n", argv[idx]);
+            if (!suggest_command(app, path.items[path.depth - 1], argv[idx], cli_stderr()))
+                print_command_help(app, &path);
+            return parse_exit(result, CLI_PARSE_ERROR, 1);
+        }
+        path.items[path.depth++] = cmd;
+        idx++;
+    }
+
+    parse_command_args(app, arena, &path, argc, argv, idx, result);
+}
+
+cli_parse_result* cli_parse(const cli_app* app, cli_arena* arena, const i32 argc, char** argv) {
+    if (!app->frozen)
+        cli_panic("error: cli_parse() requires a frozen app, call cli_app_freeze() first");
+
+    // Results parsed without an arena replace the previous one on this thread
+    if (arena == NULL) {
+        if (t_parse_arena == NULL)
+            t_parse_arena = arena_create(CLI_ARENA_CHUNK_SIZE);
+        arena = t_parse_arena;
+        arena_clear(arena);
+    }
+
+    TRACE_BEGIN(start);
+    cli_parse_result* result = ARENA_ALLOC(arena, cli_parse_result);
+    result->app              = app;
+    parse_invocation(app, arena, argc, argv, result);
+    TRACE_END(start, parse_ns);
+
+    return result;
+}
+
+i32 cli_dispatch(const cli_parse_result* result) {
+    if (result->status != CLI_PARSE_OK)
+        return result->exit_code;
+
+    TRACE_BEGIN(start);
+    i32 exit_code;
+    if (result->command != NULL && result->command->action_ex != NULL) {
+        exit_code = result->command->action_ex(result);
+    } else {
+        cli_action action = result->command ? result->command->action : *(result->app->default_action);
+        exit_code         = action(result->options, result->option_count);
+    }
+    TRACE_END(start, action_ns);
+
+    return exit_code;
+}
+
+#ifdef CLI_ENABLE_TRACE
+// Copy `str` into `out` as the inside of a JSON string, truncated to fit
+static void trace_escape(char* out, size_t size, const char* str, size_t len) {
+    size_t n = 0;
+    for (size_t i = 0; i < len && n + 7 <= size; i++) {
+        u8 c = (u8)str[i];
+        if (c == '"' || c == '\\') {
+            out[n++] = '\\';
+            out[n++] = (char)c;
+        } else if (c < 0x20) {
+            n += (size_t)snprintf(out + n, size - n, "\\u%04x", c);
+        } else {
+            out[n++] = (char)c;
+        }
+    }
+    out[n] = '\0';
+}
+
+// snprintf() onto the end of `buf`. `len` never passes the terminator, so once full the rest is dropped.
+__attribute__((format(printf, 4, 5))) static void trace_append(
+  char* buf, size_t size, size_t* len, const char* fmt, ...) {
+    if (*len + 1 >= size)
+        return;
+
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf + *len, size - *len, fmt, args);
+    va_end(args);
+    if (n > 0)
+        *len = MIN(*len + (size_t)n, size - 1);
+}
+
+// One record per invocation, written with a single write() so records from different threads never interleave
+static void trace_record(const cli_parse_result* parsed, i32 exit_code, u64 start) {
+    const cli_app* app      = parsed->app;
+    const cli_name* command = parsed->command ? &parsed->command->name_list[0] : NULL;
+    const trace_counters* t = &t_trace;
+    u64 run_ns              = trace_now() - start;
+
+    char name[256], command_name[256];
+    trace_escape(name, sizeof(name), app->name, strlen(app->name));
+    trace_escape(command_name, sizeof(command_name), command ? command->str : "", command ? command->len : 0);
+
+    // Fits the longest escaped names and counters, so only a corrupt record would be cut short
+    char buf[2048];
+    size_t len = 0;
+    if (trace_chrome) {
+        // The invocation, then its parse and action phases laid end to end inside it
+        static const char* event = "{\"name\":\"%s%s%s\",\"cat\":\"clic\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                                   "\"pid\":%d,\"tid\":%ld";
+        int pid                  = (int)getpid();
+        long tid                 = (long)syscall(SYS_gettid);
+
+        trace_append(buf, sizeof(buf), &len, event, name, " ", command_name, start / 1e3, run_ns / 1e3, pid, tid);
+        trace_append(buf,
+                     sizeof(buf),
+                     &len,
+                     ",\"args\":{\"exit_code\":%d,\"create_ns\":%lu,\"register_ns\":%lu,\"help_ns\":%lu,"
+                     "\"lookups\":%lu,\"probes\":%lu,\"allocs\":%lu,\"alloc_bytes\":%lu,\"bytes_copied\":%lu}},\n",
+                     exit_code,
+                     app->trace_create_ns,
+                     app->trace_register_ns,
+                     t->help_ns,
+                     t->lookups,
+                     t->probes,
+                     t->allocs,
+                     t->alloc_bytes,
+                     t->bytes_copied);
+        trace_append(buf, sizeof(buf), &len, event, "parse", "", "", start / 1e3, t->parse_ns / 1e3, pid, tid);
+        trace_append(buf, sizeof(buf), &len, "},\n");
+        trace_append(buf, sizeof(buf), &len, event, "action", "", "", (start + t->parse_ns) / 1e3, t->action_ns / 1e3,
+                     pid, tid);
+        trace_append(buf, sizeof(buf), &len, "},\n");
+    } else {
+        trace_append(buf,
+                     sizeof(buf),
+                     &len,
+                     "{\"app\":\"%s\",\"command\":\"%s\",\"exit_code\":%d,\"create_ns\":%lu,\"register_ns\":%lu,"
+                     "\"run_ns\":%lu,\"parse_ns\":%lu,\"help_ns\":%lu,\"action_ns\":%lu,\"lookups\":%lu,"
+                     "\"probes\":%lu,\"allocs\":%lu,\"alloc_bytes\":%lu,\"bytes_copied\":%lu}\n",
+                     name,
+                     command_name,
+                     exit_code,
+                     app->trace_create_ns,
+                     app->trace_register_ns,
+                     run_ns,
+                     t->parse_ns,
+                     t->help_ns,
+                     t->action_ns,
+                     t->lookups,
+                     t->probes,
+                     t->allocs,
+                     t->alloc_bytes,
+                     t->bytes_copied);
+    }
+
+    if (len > 0)
+        (void)!write(trace_fd, buf, len);
+}
+#endif
+
+// Parse and dispatch one invocation. Only `arena` is written to, so this is safe to call from several threads as long
+// as each brings its own arena.
+static int run_invocation(const cli_app* app, cli_arena* arena, const i32 argc, char** argv) {
+#ifdef CLI_ENABLE_TRACE
+    memset(&t_trace, 0, sizeof(t_trace));
+#endif
+    TRACE_BEGIN(start);
+
+    // Everything allocated while parsing and running the action is released afterwards
+    cli_arena_temp scratch   = arena_temp_begin(arena);
+    cli_parse_result* parsed = cli_parse(app, arena, argc, argv);
+    int result               = cli_dispatch(parsed);
+    if (t_out != NULL)
+        cli_writer_flush(t_out);
+#ifdef CLI_ENABLE_TRACE
+    if (TRACE_ACTIVE)
+        trace_record(parsed, result, start);
+#endif
+    arena_temp_end(scratch);
+
+    return result;
+}
+
+static int run_batch_flag(cli_app* app, const i32 argc, char** argv);
+static int run_complete(const cli_app* app, const i32 argc, char** argv);
+static int run_completion_script(const cli_app* app, const i32 argc, char** argv);
+static int run_dump(const cli_app* app);
+static int run_response_files(const cli_app* app, const i32 argc, char** argv);
+
+int cli_app_run(cli_app* app, const i32 argc, char** argv) {
+    cli_app_freeze(app);
+
+    // Hidden entry points used by the shell glue scripts
+    if (argc >= 2 && STREQ(argv[1], "__complete"))
+        return run_complete(app, argc - 2, argv + 2);
+    if (argc >= 2 && STREQ(argv[1], "__completion"))
+        return run_completion_script(app, argc - 2, argv + 2);
+    if (argc >= 2 && STREQ(argv[1], "__dump"))
+        return run_dump(app);
+
+    if (app->batch_enabled && argc >= 2 && (STREQ(argv[1], "--batch") || STREQ(argv[1], "--batch0")))
+        return run_batch_flag(app, argc, argv);
+
+    for (i32 i = 1; i < argc && strcmp(argv[i], "--") != 0; i++) {
+        if (argv[i][0] == '@')
+            return run_response_files(app, argc, argv);
+    }
+
+    return run_invocation(app, cli_thread_arena(), argc, argv);
+}
+
+void cli_app_enable_batch(cli_app* app, bool enabled) {
+    app->batch_enabled = enabled;
+}
+
+static _Thread_local FILE* t_stdout;
+static _Thread_local FILE* t_stderr;
+
+FILE* cli_stdout(void) {
+    return t_stdout ? t_stdout : stdout;
+}
+
+FILE* cli_stderr(void) {
+    return t_stderr ? t_stderr : stderr;
+}
+
+/*********************************************************************/
+/* Buffered output                                                   */
+/*********************************************************************/
+
+void cli_writer_init(cli_writer* writer, FILE* file, int fd) {
+    writer->file     = file;
+    writer->fd       = fd;
+    writer->data     = NULL;
+    writer->len      = 0;
+    writer->capacity = 0;
+}
+
+void cli_writer_free(cli_writer* writer) {
+    cli_writer_flush(writer);
+    free(writer->data);
+    writer->data     = NULL;
+    writer->capacity = 0;
+}
+
+bool cli_writer_flush(cli_writer* writer) {
+    if (writer->len == 0)
+        return true;
+
+    bool ok = true;
+    if (writer->file != NULL) {
+        ok = fwrite(writer->data, 1, writer->len, writer->file) == writer->len;
+    } else if (writer->fd >= 0) {
+        for (size_t done = 0; done < writer->len;) {
+            ssize_t n = write(writer->fd, writer->data + done, writer->len - done);
+            if (n < 0) {
+                ok = false;
+                break;
+            }
+            done += (size_t)n;
+        }
+    } else {
+        return true;  // In-memory writers keep their contents
+    }
+
+    writer->len = 0;
+    return ok;
+}
+
+// Make room for `len` more bytes: flush if there is a sink, grow otherwise
+static void writer_reserve(cli_writer* writer, size_t len) {
+    if (writer->len + len <= writer->capacity)
+        return;
+
+    bool has_sink = writer->file != NULL || writer->fd >= 0;
+    if (has_sink && writer->len > 0) {
+        cli_writer_flush(writer);
+        if (len <= writer->capacity)
+            return;
+    }
+
+    size_t capacity = MAX(writer->capacity ? writer->capacity : (size_t)CLI_WRITER_SIZE, (size_t)256);
+    while (capacity < writer->len + len)
+        capacity *= 2;
+
+    char* data = (char*)realloc(writer->data, capacity);
+    if (data == NULL)
+        cli_panic("error: failed to grow output buffer to %zu bytes", capacity);
+    writer->data     = data;
+    writer->capacity = capacity;
+}
+
+void cli_write(cli_writer* writer, const void* data, size_t len) {
+    writer_reserve(writer, len);
+    memcpy(writer->data + writer->len, data, len);
+    writer->len += len;
+}
+
+void cli_write_str(cli_writer* writer, const char* str) {
+    cli_write(writer, str, strlen(str));
+}
+
+void cli_write_u64(cli_writer* writer, u64 value) {
+    char digits[20];
+    size_t n = sizeof(digits);
+    do {
+        digits[--n] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    cli_write(writer, digits + n, sizeof(digits) - n);
+}
+
+void cli_write_pad(cli_writer* writer, char c, size_t count) {
+    writer_reserve(writer, count);
+    memset(writer->data + writer->len, c, count);
+    writer->len += count;
+}
+
+void cli_writef(cli_writer* writer, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    char* end = writer->data ? writer->data + writer->len : NULL;
+    int len   = vsnprintf(end, writer->capacity - writer->len, fmt, args);
+    va_end(args);
+    if (len < 0 || writer->len + (size_t)len < writer->capacity) {
+        writer->len += len > 0 ? (size_t)len : 0;
+        return;
+    }
+
+    // Didn't fit: make room and format again
+    writer_reserve(writer, (size_t)len + 1);
+    va_start(args, fmt);
+    vsnprintf(writer->data + writer->len, writer->capacity - writer->len, fmt, args);
+    va_end(args);
+    writer->len += (size_t)len;
+}
+
+cli_writer* cli_out(void) {
+    FILE* file = cli_stdout();
+    if (t_out == NULL) {
+        t_out = (cli_writer*)malloc(sizeof(cli_writer));
+        if (t_out == NULL)
+            cli_panic("error: failed to allocate output writer");
+        cli_writer_init(t_out, file, -1);
+    } else if (t_out->file != file) {
+        // The batch capture stream changed since the last invocation on this thread
+        cli_writer_flush(t_out);
+        t_out->file = file;
+    }
+
+    return t_out;
+}
+
+/*********************************************************************/
+/* Thread pool                                                       */
+/*********************************************************************/
+
+#ifndef CLI_NO_THREADS
+
+typedef struct {
+    cli_task fn;
+    void* arg;
+} pool_task;
+
+// Each worker owns a deque. The owner pushes and pops at the tail (LIFO), idle workers steal from the head (FIFO).
+typedef struct {
+    pthread_mutex_t mutex;
+    pool_task* tasks;
+    u32 capacity;  // Always a power of two
+    u32 head;
+    u32 tail;
+} pool_deque;
+
+typedef struct {
+    cli_pool* pool;
+    u32 index;
+} pool_worker;
+
+struct cli_pool {
+    pthread_t* threads;
+    pool_worker* workers;
+    pool_deque* deques;
+    u32 thread_count;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;  // Signalled when tasks are queued or the pool stops
+    pthread_cond_t done_cond;  // Signalled when the last pending task finishes
+    atomic_uint queued;        // Tasks sitting in deques
+    atomic_uint pending;       // Tasks submitted but not yet finished
+    atomic_uint sleeping;      // Workers blocked on work_cond
+    atomic_uint next_deque;    // Round-robin target for submissions from outside the pool
+    bool stop;
+};
+
+static _Thread_local cli_pool* t_pool;
+static _Thread_local u32 t_worker;
+
+static void pool_deque_push(pool_deque* deque, pool_task task) {
+    pthread_mutex_lock(&deque->mutex);
+    if (deque->tail - deque->head == deque->capacity) {
+        u32 capacity     = deque->capacity ? deque->capacity * 2 : 64;
+        pool_task* tasks = (pool_task*)malloc(sizeof(pool_task) * capacity);
+        if (tasks == NULL)
+            cli_panic("error: failed to grow task deque to %u entries", capacity);
+        for (u32 i = deque->head; i != deque->tail; i++) {
+            tasks[i & (capacity - 1)] = deque->tasks[i & (deque->capacity - 1)];
+        }
+        free(deque->tasks);
+        deque->tasks    = tasks;
+        deque->capacity = capacity;
+    }
+    deque->tasks[deque->tail++ & (deque->capacity - 1)] = task;
+    pthread_mutex_unlock(&deque->mutex);
+}
+
+static bool pool_deque_take(pool_deque* deque, pool_task* task, bool steal) {
+    pthread_mutex_lock(&deque->mutex);
+    bool found = deque->head != deque->tail;
+    if (found) {
+        u32 slot = steal ? deque->head++ : --deque->tail;
+        *task    = deque->tasks[slot & (deque->capacity - 1)];
+    }
+    pthread_mutex_unlock(&deque->mutex);
+
+    return found;
+}
+
+// Pop from our own deque first, then try to steal from the others
+static bool pool_take(cli_pool* pool, u32 worker, pool_task* task) {
+    for (u32 i = 0; i < pool->thread_count; i++) {
+        pool_deque* deque = &pool->deques[(worker + i) % pool->thread_count];
+        if (pool_deque_take(deque, task, i != 0)) {
+            atomic_fetch_sub(&pool->queued, 1);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void* pool_worker_main(void* arg) {
+    pool_worker* worker = (pool_worker*)arg;
+    cli_pool* pool      = worker->pool;
+    t_pool              = pool;
+    t_worker            = worker->index;
+
+    for (;;) {
+        pool_task task;
+        if (atomic_load(&pool->queued) > 0 && pool_take(pool, worker->index, &task)) {
+            task.fn(task.arg, worker->index);
+            if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+                pthread_mutex_lock(&pool->mutex);
+                pthread_cond_broadcast(&pool->done_cond);
+                pthread_mutex_unlock(&pool->mutex);
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->mutex);
+        atomic_fetch_add(&pool->sleeping, 1);
+        while (atomic_load(&pool->queued) == 0 && !pool->stop) {
+            pthread_cond_wait(&pool->work_cond, &pool->mutex);
+        }
+        atomic_fetch_sub(&pool->sleeping, 1);
+        bool stop = pool->stop && atomic_load(&pool->queued) == 0;
+        pthread_mutex_unlock(&pool->mutex);
+
+        if (stop)
+            break;
+    }
+
+    // Arenas and the output writer tasks may have created on this thread
+    cli_thread_arena_release();
+    return NULL;
+}
+
+cli_pool* cli_pool_create(u32 threads) {
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads   = cpus > 0 ? (u32)cpus : 1;
+    }
+
+    cli_pool* pool = (cli_pool*)calloc(1, sizeof(cli_pool));
+    if (pool == NULL)
+        cli_panic("error: failed to allocate thread pool");
+
+    pool->thread_count = threads;
+    pool->threads      = (pthread_t*)calloc(threads, sizeof(pthread_t));
+    pool->workers      = (pool_worker*)calloc(threads, sizeof(pool_worker));
+    pool->deques       = (pool_deque*)calloc(threads, sizeof(pool_deque));
+    if (!pool->threads || !pool->workers || !pool->deques)
+        cli_panic("error: failed to allocate thread pool");
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    for (u32 i = 0; i < threads; i++) {
+        pthread_mutex_init(&pool->deques[i].mutex, NULL);
+        pool->workers[i].pool  = pool;
+        pool->workers[i].index = i;
+    }
+
+    for (u32 i = 0; i < threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, pool_worker_main, &pool->workers[i]) != 0)
+            cli_panic("error: failed to start worker thread %u", i);
+    }
+
+    return pool;
+}
+
+void cli_pool_destroy(cli_pool* pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (u32 i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    for (u32 i = 0; i < pool->thread_count; i++) {
+        pthread_mutex_destroy(&pool->deques[i].mutex);
+        free(pool->deques[i].tasks);
+    }
+
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_cond_destroy(&pool->done_cond);
+    free(pool->deques);
+    free(pool->workers);
+    free(pool->threads);
+    free(pool);
+}
+
+// From inside a task the new task goes to the current worker's deque, otherwise deques are filled round-robin
+void cli_pool_submit(cli_pool* pool, cli_task task, void* arg) {
+    u32 target = t_pool == pool ? t_worker : atomic_fetch_add(&pool->next_deque, 1) % pool->thread_count;
+
+    atomic_fetch_add(&pool->pending, 1);
+    atomic_fetch_add(&pool->queued, 1);
+    pool_deque_push(&pool->deques[target], (pool_task) {task, arg});
+
+    if (atomic_load(&pool->sleeping) > 0) {
+        pthread_mutex_lock(&pool->mutex);
+        pthread_cond_signal(&pool->work_cond);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+void cli_pool_wait(cli_pool* pool) {
+    pthread_mutex_lock(&pool->mutex);
+    while (atomic_load(&pool->pending) != 0) {
+        pthread_cond_wait(&pool->done_cond, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+u32 cli_pool_size(const cli_pool* pool) {
+    return pool->thread_count;
+}
+
+#endif  // CLI_NO_THREADS
+
+/*********************************************************************/
+/* Batch mode                                                        */
+/*********************************************************************/
+
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} batch_record;
+
+static void batch_record_append(batch_record* record, char c) {
+    if (record->length == record->capacity) {
+        size_t capacity = record->capacity ? record->capacity * 2 : KB(4);
+        char* data      = (char*)realloc(record->data, capacity);
+        if (data == NULL)
+            cli_panic("error: failed to allocate batch record of %zu bytes", capacity);
+        record->data     = data;
+        record->capacity = capacity;
+    }
+    record->data[record->length++] = c;
+}
+
+// Read one invocation worth of input into `record`. The buffer is reused for every record.
+static bool batch_read_record(FILE* in, batch_record* record, bool nul_delimited) {
+    record->length = 0;
+
+    int c, prev = EOF;
+    while ((c = getc_unlocked(in)) != EOF) {
+        if (!nul_delimited && c == '\n')
+            break;
+        batch_record_append(record, (char)c);
+        if (nul_delimited && c == '\0' && (prev == '\0' || record->length == 1))
+            break;
+        prev = c;
+    }
+
+    if (c == EOF && record->length == 0)
+        return false;
+
+    batch_record_append(record, '\0');
+    return true;
+}
+
+// Blank records are skipped rather than printing the app help for them
+static bool batch_record_is_blank(const char* data, bool nul_delimited) {
+    if (nul_delimited)
+        return data[0] == '\0';
+
+    while (*data == ' ' || *data == '\t' || *data == '\r')
+        data++;
+    return *data == '\0';
+}
+
+static void batch_push_arg(cli_arena* arena, char*** argv, i32* argc, u32* capacity, char* arg) {
+    *argv              = (char**)arena_grow_array(arena, *argv, sizeof(char*), (u32)*argc, capacity);
+    (*argv)[(*argc)++] = arg;
+}
+
+static inline bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Unquote the word at `src` in place: '...' is literal, "..." and bare text honour backslash. Stops at unquoted
+// whitespace or `end`, which is stored in `*next`. Returns the end of the unquoted text.
+static char* unquote_word(char* src, const char* end, char** next) {
+    char* dst  = src;
+    char quote = 0;
+    while (src < end && (quote || !is_blank(*src))) {
+        char c = *src++;
+        if (quote == '\'') {
+            if (c == '\'')
+                quote = 0;
+            else
+                *dst++ = c;
+        } else if (c == '\\' && src < end) {
+            *dst++ = *src++;
+        } else if (c == quote) {
+            quote = 0;
+        } else if (!quote && (c == '"' || c == '\'')) {
+            quote = c;
+        } else {
+            *dst++ = c;
+        }
+    }
+
+    *next = src;
+    return dst;
+}
+
+// Tokenize a line in place: whitespace separates arguments
+static char** batch_split_line(const cli_app* app, cli_arena* arena, char* line, i32* argc) {
+    char** argv  = NULL;
+    u32 capacity = 0;
+    *argc        = 0;
+    batch_push_arg(arena, &argv, argc, &capacity, (char*)app->name);
+
+    char* src = line;
+    char* end = line + strlen(line);
+    while (src < end) {
+        while (src < end && is_blank(*src))
+            src++;
+        if (src == end)
+            break;
+
+        char* start = src;
+        char* dst   = unquote_word(src, end, &src);
+        bool at_end = src == end;
+        *dst        = '\0';
+        batch_push_arg(arena, &argv, argc, &capacity, start);
+        if (at_end)
+            break;
+        src++;
+    }
+
+    batch_push_arg(arena, &argv, argc, &capacity, NULL);
+    (*argc)--;
+    return argv;
+}
+
+static char** batch_split_nul(const cli_app* app, cli_arena* arena, char* data, size_t length, i32* argc) {
+    char** argv  = NULL;
+    u32 capacity = 0;
+    *argc        = 0;
+    batch_push_arg(arena, &argv, argc, &capacity, (char*)app->name);
+
+    // `length` includes the terminator appended by batch_read_record
+    char* end = data + length - 1;
+    for (char* arg = data; arg < end && *arg; arg += strlen(arg) + 1) {
+        batch_push_arg(arena, &argv, argc, &capacity, arg);
+    }
+
+    batch_push_arg(arena, &argv, argc, &capacity, NULL);
+    (*argc)--;
+    return argv;
+}
+
+static char** batch_split(
+  const cli_app* app, cli_arena* arena, char* data, size_t length, bool nul_delimited, i32* argc) {
+    return nul_delimited ? batch_split_nul(app, arena, data, length, argc) : batch_split_line(app, arena, data, argc);
+}
+
+static void batch_report(const cli_batch_config* config, u32 index, int code) {
+    if (config->status) {
+        fflush(stdout);
+        fprintf(config->status, "%u\t%d\n", index, code);
+    }
+}
+
+static int run_batch_sequential(const cli_app* app, FILE* in, const cli_batch_config* config) {
+    cli_arena* arena    = cli_thread_arena();
+    batch_record record = {0};
+    u32 index           = 0;
+    bool failed         = false;
+
+    while (batch_read_record(in, &record, config->nul_delimited)) {
+        if (batch_record_is_blank(record.data, config->nul_delimited))
+            continue;
+
+        // Per-invocation state lives in a scratch scope, so every record starts from the same arena position
+        cli_arena_temp scratch = arena_temp_begin(arena);
+
+        i32 argc;
+        char** argv = batch_split(app, arena, record.data, record.length, config->nul_delimited, &argc);
+        int code    = run_invocation(app, arena, argc, argv);
+        failed |= code != 0;
+        batch_report(config, ++index, code);
+
+        arena_temp_end(scratch);
+    }
+
+    free(record.data);
+
+    return failed ? 1 : 0;
+}
+
+#ifndef CLI_NO_THREADS
+
+typedef struct batch_state batch_state;
+
+typedef struct {
+    batch_state* state;
+    u32 index;  // 1-based, in input order
+    char* data;
+    size_t length;
+    char* out;
+    size_t out_len;
+    char* err;
+    size_t err_len;
+    int code;
+    bool done;
+} batch_job;
+
+struct batch_state {
+    const cli_app* app;
+    const cli_batch_config* config;
+    cli_arena** arenas;  // One per worker
+    batch_job** window;  // In-flight jobs by index, only used for ordered output
+    u32 window_size;
+    u32 in_flight;  // Jobs submitted but not yet emitted
+    u32 next_emit;
+    bool failed;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+// Called with state->mutex held
+static void batch_emit(batch_state* state, batch_job* job) {
+    if (job->out_len > 0)
+        fwrite(job->out, 1, job->out_len, stdout);
+    if (job->err_len > 0) {
+        fflush(stdout);
+        fwrite(job->err, 1, job->err_len, stderr);
+    }
+    batch_report(state->config, job->index, job->code);
+    state->failed |= job->code != 0;
+    state->in_flight--;
+
+    free(job->out);
+    free(job->err);
+    free(job->data);
+    free(job);
+}
+
+static void batch_job_run(void* arg, u32 worker) {
+    batch_job* job     = (batch_job*)arg;
+    batch_state* state = job->state;
+    cli_arena* arena   = state->arenas[worker];
+
+    cli_arena_temp scratch = arena_temp_begin(arena);
+
+    i32 argc;
+    char** argv = batch_split(state->app, arena, job->data, job->length, state->config->nul_delimited, &argc);
+
+    FILE* out = open_memstream(&job->out, &job->out_len);
+    FILE* err = open_memstream(&job->err, &job->err_len);
+    if (out == NULL || err == NULL)
+        cli_panic("error: failed to capture output of batch invocation %u", job->index);
+
+    t_stdout  = out;
+    t_stderr  = err;
+    job->code = run_invocation(state->app, arena, argc, argv);
+    t_stdout  = NULL;
+    t_stderr  = NULL;
+    fclose(out);
+    fclose(err);
+
+    arena_temp_end(scratch);
+
+    pthread_mutex_lock(&state->mutex);
+    if (state->config->unordered) {
+        batch_emit(state, job);
+    } else {
+        // Emit every finished job at the front of the window
+        job->done = true;
+        batch_job* next;
+        while ((next = state->window[state->next_emit % state->window_size]) != NULL && next->done) {
+            state->window[state->next_emit % state->window_size] = NULL;
+            state->next_emit++;
+            batch_emit(state, next);
+        }
+    }
+    pthread_cond_signal(&state->cond);
+    pthread_mutex_unlock(&state->mutex);
+}
+
+static int run_batch_parallel(const cli_app* app, FILE* in, const cli_batch_config* config) {
+    cli_pool* pool = cli_pool_create(config->jobs);
+    u32 workers    = cli_pool_size(pool);
+
+    batch_state state = {0};
+    state.app         = app;
+    state.config      = config;
+    state.window_size = workers * 16;
+    state.next_emit   = 1;
+    state.arenas      = (cli_arena**)calloc(workers, sizeof(cli_arena*));
+    state.window      = (batch_job**)calloc(state.window_size, sizeof(batch_job*));
+    if (state.arenas == NULL || state.window == NULL)
+        cli_panic("error: failed to allocate batch state");
+    for (u32 i = 0; i < workers; i++) {
+        state.arenas[i] = arena_create(CLI_ARENA_CHUNK_SIZE);
+    }
+    pthread_mutex_init(&state.mutex, NULL);
+    pthread_cond_init(&state.cond, NULL);
+
+    batch_record record = {0};
+    u32 index           = 0;
+    while (batch_read_record(in, &record, config->nul_delimited)) {
+        if (batch_record_is_blank(record.data, config->nul_delimited))
+            continue;
+
+        batch_job* job = (batch_job*)calloc(1, sizeof(batch_job));
+        char* data     = (char*)malloc(record.length);
+        if (job == NULL || data == NULL)
+            cli_panic("error: failed to allocate batch invocation %u", index + 1);
+        memcpy(data, record.data, record.length);
+        job->state  = &state;
+        job->index  = ++index;
+        job->data   = data;
+        job->length = record.length;
+
+        // Bound the number of buffered invocations so memory stays flat for long job streams
+        pthread_mutex_lock(&state.mutex);
+        while (state.in_flight >= state.window_size) {
+            pthread_cond_wait(&state.cond, &state.mutex);
+        }
+        state.in_flight++;
+        if (!config->unordered)
+            state.window[job->index % state.window_size] = job;
+        pthread_mutex_unlock(&state.mutex);
+
+        cli_pool_submit(pool, batch_job_run, job);
+    }
+
+    cli_pool_wait(pool);
+    cli_pool_destroy(pool);
+
+    for (u32 i = 0; i < workers; i++) {
+        arena_destroy(state.arenas[i]);
+    }
+    pthread_mutex_destroy(&state.mutex);
+    pthread_cond_destroy(&state.cond);
+    free(state.arenas);
+    free(state.window);
+    free(record.data);
+
+    return state.failed ? 1 : 0;
+}
+
+#endif  // CLI_NO_THREADS
+
+int cli_app_run_batch_ex(cli_app* app, FILE* in, const cli_batch_config* config) {
+    cli_app_freeze(app);
+
+    int result;
+#ifndef CLI_NO_THREADS
+    if (config->jobs > 1)
+        result = run_batch_parallel(app, in, config);
+    else
+#endif
+        result = run_batch_sequential(app, in, config);
+
+    return result;
+}
+
+int cli_app_run_batch(cli_app* app, FILE* in) {
+    cli_batch_config config = {0};
+    config.status           = stderr;
+    return cli_app_run_batch_ex(app, in, &config);
+}
+
+// `<app> --batch [-j N] [--unordered] [file]` reads lines, `--batch0` reads NUL-delimited arguments. Defaults to stdin.
+static int run_batch_flag(cli_app* app, const i32 argc, char** argv) {
+    cli_batch_config config = {0};
+    config.nul_delimited    = STREQ(argv[1], "--batch0");
+    config.status           = stderr;
+
+    const char* path = NULL;
+    for (i32 i = 2; i < argc; i++) {
+        const char* arg = argv[i];
+        if (STREQ(arg, "--jobs") || STREQ(arg, "-j")) {
+            char* end;
+            long jobs = i + 1 < argc ? strtol(argv[i + 1], &end, 10) : -1;
+            if (jobs < 0 || *end != '\0') {
+                fprintf(stderr, "error: option '%s' requires a thread count\n", arg);
+                return 1;
+            }
+            // 0 means one job per online CPU
+            config.jobs = jobs > 0 ? (u32)jobs : (u32)MAX(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+            i++;
+        } else if (STREQ(arg, "--unordered")) {
+            config.unordered = true;
+        } else if (path == NULL && (!is_option_arg(arg) || STREQ(arg, "-"))) {
+            path = arg;
+        } else {
+            fprintf(stderr, "error: unexpected argument '%s'\n", arg);
+            return 1;
+        }
+    }
+
+    FILE* in = stdin;
+    if (path != NULL && !STREQ(path, "-")) {
+        in = fopen(path, "r");
+        if (in == NULL) {
+            perror(path);
+            return 1;
+        }
+    }
+
+    int result = cli_app_run_batch_ex(app, in, &config);
+    if (in != stdin)
+        fclose(in);
+
+    return result;
+}
+
+/*********************************************************************/
+/* Response files                                                    */
+/*********************************************************************/
+
+// Scanned NUL-delimited files are released from memory in windows of this size. Must be a multiple of the page size.
+#ifndef CLI_RESPONSE_WINDOW
+    #define CLI_RESPONSE_WINDOW MB(1)
+#endif
+
+#define RESPONSE_MAX_DEPTH 32
+
+typedef struct {
+    char* base;  // Mapping of the whole file, NULL if it is empty
+    size_t size;
+    char* tail;  // Copy of the last argument when it ends exactly on a page boundary
+    dev_t dev;
+    ino_t ino;
+    u32 first;  // The file's arguments are argv[first, first + count)
+    u32 count;
+    bool open;  // Still being expanded, so seeing it again is a cycle
+} response_file;
+
+typedef struct {
+    char** argv;
+    u32 argc;
+    u32 capacity;
+    response_file* files;
+    u32 file_count;
+    u32 file_capacity;
+    u32 depth;
+    bool ended;  // "--" has been pushed, so later "@path" arguments are passed through
+} response_args;
+
+static void response_push(response_args* args, char* arg) {
+    if (args->argc == args->capacity) {
+        u32 capacity = args->capacity ? args->capacity * 2 : 256;
+        char** argv  = (char**)realloc(args->argv, sizeof(char*) * capacity);
+        if (argv == NULL)
+            cli_panic("error: failed to grow argument list to %u entries", capacity);
+        args->argv     = argv;
+        args->capacity = capacity;
+    }
+    if (args->argc > 0 && arg != NULL && STREQ(arg, "--"))
+        args->ended = true;
+    args->argv[args->argc++] = arg;
+}
+
+static bool response_expand(response_args* args, char* arg);
+
+static bool response_add(response_args* args, char* arg) {
+    if (arg[0] == '@' && !args->ended)
+        return response_expand(args, arg);
+    response_push(args, arg);
+    return true;
+}
+
+// A token that runs up to the end of the file is terminated by the zero fill after it, unless the file ends exactly on
+// a page boundary or the mapping is read-only. Only then is it copied.
+static char* response_terminate(response_args* args, u32 index, char* token, char* end, bool writable) {
+    response_file* file = &args->files[index];
+    if (writable && file->size % (size_t)sysconf(_SC_PAGESIZE) != 0) {
+        *end = '\0';
+        return token;
+    }
+
+    size_t len = (size_t)(end - token);
+    file->tail = (char*)malloc(len + 1);
+    if (file->tail == NULL)
+        cli_panic("error: failed to allocate %zu bytes for a response file argument", len + 1);
+    memcpy(file->tail, token, len);
+    file->tail[len] = '\0';
+    TRACE_COUNT(bytes_copied, len + 1);
+
+    return file->tail;
+}
+
+// Arguments are left in the mapping and referenced from there. In a NUL-delimited file they are already terminated, so
+// the mapping stays read-only and every window that has been scanned can be dropped: the parser faults it back in from
+// the page cache. Shell-quoted files are unquoted in place, which makes private copies of the pages.
+static bool response_split(response_args* args, u32 index) {
+    char* base = args->files[index].base;
+    char* end  = base + args->files[index].size;
+
+    const char* newline = (const char*)memchr(base, '\n', (size_t)(end - base));
+    bool nul_delimited  = memchr(base, '\0', (size_t)((newline ? newline : end) - base)) != NULL;
+    if (!nul_delimited && mprotect(base, args->files[index].size, PROT_READ | PROT_WRITE) != 0) {
+        fprintf(cli_stderr(), "error: failed to map response file: %s\n", strerror(errno));
+        return false;
+    }
+
+    size_t released = 0;
+    char* src       = base;
+    while (src < end) {
+        if (nul_delimited && (size_t)(src - base) - released >= CLI_RESPONSE_WINDOW) {
+            madvise(base + released, CLI_RESPONSE_WINDOW, MADV_DONTNEED);
+            released += CLI_RESPONSE_WINDOW;
+        }
+
+        char* token = src;
+        if (nul_delimited) {
+            char* stop = (char*)memchr(src, '\0', (size_t)(end - src));
+            if (stop == NULL)
+                token = response_terminate(args, index, token, end, false);
+            src = stop ? stop + 1 : end;
+        } else {
+            while (src < end && is_blank(*src))
+                src++;
+            if (src == end)
+                break;
+
+            token     = src;
+            char* dst = unquote_word(src, end, &src);
+            if (dst == end)
+                token = response_terminate(args, index, token, end, true);
+            else
+                *dst = '\0';
+            src++;
+        }
+
+        if (!response_add(args, token))
+            return false;
+    }
+
+    return true;
+}
+
+// Replace "@path" with the arguments in that file, like GCC does: option values included, but nothing after "--". If
+// the file can't be opened, "@path" is kept as it is. A file given again is not read twice: the arguments it expanded
+// to the first time are repeated.
+static bool response_expand(response_args* args, char* arg) {
+    const char* path = arg + 1;
+    int fd           = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0)
+            close(fd);
+        response_push(args, arg);
+        return true;
+    }
+
+    for (u32 i = 0; i < args->file_count; i++) {
+        const response_file* seen = &args->files[i];
+        if (seen->dev != st.st_dev || seen->ino != st.st_ino)
+            continue;
+
+        close(fd);
+        if (seen->open) {
+            fprintf(cli_stderr(), "error: response file '%s' includes itself\n", path);
+            return false;
+        }
+        for (u32 j = 0; j < seen->count; j++) {
+            response_push(args, args->argv[seen->first + j]);
+        }
+        return true;
+    }
+
+    if (args->depth == RESPONSE_MAX_DEPTH) {
+        close(fd);
+        fprintf(cli_stderr(), "error: response file '%s' is nested more than %d deep\n", path, RESPONSE_MAX_DEPTH);
+        return false;
+    }
+
+    char* base  = NULL;
+    size_t size = (size_t)st.st_size;
+    if (size > 0) {
+        base = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base == MAP_FAILED) {
+            fprintf(cli_stderr(), "error: failed to map response file '%s': %s\n", path, strerror(errno));
+            close(fd);
+            return false;
+        }
+        madvise(base, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    if (args->file_count == args->file_capacity) {
+        u32 capacity          = args->file_capacity ? args->file_capacity * 2 : 8;
+        response_file* files = (response_file*)realloc(args->files, sizeof(response_file) * capacity);
+        if (files == NULL)
+            cli_panic("error: failed to grow response file list to %u entries", capacity);
+        args->files         = files;
+        args->file_capacity = capacity;
+    }
+
+    u32 index           = args->file_count++;
+    args->files[index]  = (response_file){.base = base, .size = size, .dev = st.st_dev, .ino = st.st_ino};
+    response_file* file = &args->files[index];
+    file->first         = args->argc;
+    file->open          = true;
+
+    args->depth++;
+    bool ok = response_split(args, index);
+    args->depth--;
+
+    // The list may have moved while nested files were added
+    file        = &args->files[index];
+    file->count = args->argc - file->first;
+    file->open  = false;
+
+    return ok;
+}
+
+static void response_free(response_args* args) {
+    for (u32 i = 0; i < args->file_count; i++) {
+        if (args->files[i].base != NULL)
+            munmap(args->files[i].base, args->files[i].size);
+        free(args->files[i].tail);
+    }
+    free(args->files);
+    free(args->argv);
+}
+
+// Run an invocation whose arguments include response files. The mappings are kept until the action has returned,
+// since option values point into them.
+static int run_response_files(const cli_app* app, const i32 argc, char** argv) {
+    response_args args = {0};
+    bool ok            = true;
+    response_push(&args, argv[0]);
+    for (i32 i = 1; i < argc && ok; i++) {
+        ok = response_add(&args, argv[i]);
+    }
+
+    int result = 1;
+    if (ok) {
+        response_push(&args, NULL);
+        result = run_invocation(app, cli_thread_arena(), (i32)args.argc - 1, args.argv);
+    }
+    response_free(&args);
+
+    return result;
+}
+
+#undef RESPONSE_MAX_DEPTH
+
+/*********************************************************************/
+/* Shell completion                                                  */
+/*********************************************************************/
+
+// `prog __complete <words...>` answers one TAB press. The words are the arguments typed so far, the last one being
+// the partial word under the cursor. Candidates are written one per line; a single ":file" line asks the shell to
+// complete file names instead. Every shell request starts a new process, so instead of sorting all names into an
+// index (O(n log n) on each request) the pre-split names are scanned once and only the matches are sorted.
+
+static const cli_name complete_app_builtins[]   = {{"--help", 6, 0}, {"-h", 2, 0}, {"--version", 9, 0}, {"-v", 2, 0}};
+static const cli_name complete_batch_builtins[] = {{"--batch", 7, 0}, {"--batch0", 8, 0}};
+static const cli_name complete_cmd_builtins[]   = {{"--help", 6, 0}, {"-h", 2, 0}};
+
+#define COUNT_OF(array) (sizeof(array) / sizeof((array)[0]))
+
+typedef struct {
+    const cli_name** items;
+    u32 count;
+    const char* prefix;
+    size_t prefix_len;
+    bool skip_options;  // Leave out names starting with '-'
+} complete_matches;
+
+static void complete_add(complete_matches* matches, const cli_name* names, u32 count) {
+    for (u32 i = 0; i < count; i++) {
+        const cli_name* name = &names[i];
+        if (name->len < matches->prefix_len || memcmp(name->str, matches->prefix, matches->prefix_len) != 0)
+            continue;
+        if (matches->skip_options && name->str[0] == '-')
+            continue;
+        matches->items[matches->count++] = name;
+    }
+}
+
+static int complete_compare(const void* a, const void* b) {
+    const cli_name* x = *(const cli_name* const*)a;
+    const cli_name* y = *(const cli_name* const*)b;
+    int order         = memcmp(x->str, y->str, MIN(x->len, y->len));
+    return order != 0 ? order : (int)x->len - (int)y->len;
+}
+
+static bool complete_write(const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(STDOUT_FILENO, data, len);
+        if (written < 0)
+            return false;
+        data += written;
+        len -= (size_t)written;
+    }
+    return true;
+}
+
+static int complete_values(const cli_option* opt, const char* prefix) {
+    static const char* const booleans[] = {"false", "true"};
+    const char* const* values           = opt->type == CLI_TYPE_BOOL ? booleans : opt->choices;
+    u32 count                           = opt->type == CLI_TYPE_BOOL ? 2 : opt->choice_count;
+
+    cli_writer w;
+    cli_writer_init(&w, NULL, -1);
+    size_t prefix_len = strlen(prefix);
+    for (u32 i = 0; i < count; i++) {
+        if (strncmp(values[i], prefix, prefix_len) == 0) {
+            cli_write_str(&w, values[i]);
+            cli_write(&w, "\n", 1);
+        }
+    }
+
+    bool ok = complete_write(w.data, w.len);
+    cli_writer_free(&w);
+    return ok ? 0 : 1;
+}
+
+static int run_complete(const cli_app* app, const i32 argc, char** argv) {
+    const char* current = argc > 0 ? argv[argc - 1] : "";
+
+    // Leading words that name commands, one level each. Only that branch of the tree is looked at.
+    command_path path = {.depth = 0};
+    i32 word          = 0;
+    while (word < argc - 1 && path.depth < CLI_MAX_DEPTH) {
+        const cli_command* parent = path.depth ? path.items[path.depth - 1] : NULL;
+        const cli_command* cmd    = find_command(app, parent, argv[word], strlen(argv[word]));
+        if (cmd == NULL)
+            break;
+        path.items[path.depth++] = cmd;
+        word++;
+    }
+
+    // The previous word takes a value: file names, or the values of an enum or bool
+    u32 position;
+    if (argc > 1) {
+        const cli_option* opt = find_path_option(app, &path, argv[argc - 2], strlen(argv[argc - 2]), &position);
+        if (opt != NULL && !opt->is_flag && (opt->type == CLI_TYPE_STRING || opt->type == CLI_TYPE_PATH))
+            return complete_write(":file\n", 6) ? 0 : 1;
+        if (opt != NULL && !opt->is_flag)
+            return complete_values(opt, argv[argc - 1]);
+    }
+
+    // Subcommands are offered while every word so far named a command
+    const cli_command* cmd       = path.depth ? path.items[path.depth - 1] : NULL;
+    bool top_level               = argc <= 1;
+    cli_command* const* children = cmd ? cmd->children : app->commands;
+    u32 child_count              = word >= argc - 1 ? (cmd ? cmd->child_count : app->command_count) : 0;
+
+    u32 capacity = COUNT_OF(complete_app_builtins) + COUNT_OF(complete_batch_builtins);
+    for (u32 level = 0; level < MAX(path.depth, 1u); level++) {
+        u32 opt_count;
+        const cli_option* opts = get_command_options(app, path.depth ? path.items[level] : NULL, &opt_count);
+        for (u32 i = 0; i < opt_count; i++) {
+            capacity += opts[i].name_count;
+        }
+    }
+    for (u32 i = 0; i < child_count; i++) {
+        capacity += children[i]->name_count;
+    }
+
+    cli_arena* arena       = cli_thread_arena();
+    cli_arena_temp scratch = arena_temp_begin(arena);
+
+    complete_matches matches;
+    matches.items      = (const cli_name**)arena_push(arena, sizeof(cli_name*) * capacity, true);
+    matches.count      = 0;
+    matches.prefix     = current;
+    matches.prefix_len = strlen(current);
+    // Commands first: options only show up where a command is expected once a '-' is typed
+    matches.skip_options = child_count > 0 && current[0] != '-';
+
+    for (u32 i = 0; i < child_count; i++) {
+        complete_add(&matches, children[i]->name_list, children[i]->name_count);
+    }
+    if (top_level) {
+        complete_add(&matches, complete_app_builtins, COUNT_OF(complete_app_builtins));
+        if (app->batch_enabled)
+            complete_add(&matches, complete_batch_builtins, COUNT_OF(complete_batch_builtins));
+    } else {
+        complete_add(&matches, complete_cmd_builtins, COUNT_OF(complete_cmd_builtins));
+    }
+    for (u32 level = 0; level < MAX(path.depth, 1u); level++) {
+        u32 opt_count;
+        const cli_option* opts = get_command_options(app, path.depth ? path.items[level] : NULL, &opt_count);
+        for (u32 i = 0; i < opt_count; i++) {
+            complete_add(&matches, opts[i].name_list, opts[i].name_count);
+        }
+    }
+
+    qsort(matches.items, matches.count, sizeof(cli_name*), complete_compare);
+
+    size_t size = 0;
+    for (u32 i = 0; i < matches.count; i++) {
+        size += matches.items[i]->len + 1;
+    }
+
+    // Every candidate goes out in one write, duplicates (a name registered twice) are dropped
+    char* out  = (char*)arena_push(arena, size + 1, true);
+    size_t len = 0;
+    for (u32 i = 0; i < matches.count; i++) {
+        const cli_name* name = matches.items[i];
+        if (i > 0 && complete_compare(&matches.items[i - 1], &matches.items[i]) == 0)
+            continue;
+        memcpy(out + len, name->str, name->len);
+        len += name->len;
+        out[len++] = '\n';
+    }
+
+    bool ok = complete_write(out, len);
+    arena_temp_end(scratch);
+
+    return ok ? 0 : 1;
+}
+
+static const char complete_bash[] =
+  "_%1$s_complete() {\n"
+  "    local IFS=$'\\n'\n"
+  "    local candidates=($(%1$s __complete \"${COMP_WORDS[@]:1:COMP_CWORD}\" 2>/dev/null))\n"
+  "    if [[ \"${candidates[0]}\" == :file ]]; then\n"
+  "        COMPREPLY=($(compgen -f -- \"${COMP_WORDS[COMP_CWORD]}\"))\n"
+  "    else\n"
+  "        COMPREPLY=(\"${candidates[@]}\")\n"
+  "    fi\n"
+  "}\n"
+  "complete -o default -F _%1$s_complete %1$s\n";
+
+static const char complete_zsh[] =
+  "#compdef %1$s\n"
+  "_%1$s() {\n"
+  "    local -a candidates\n"
+  "    candidates=(\"${(@f)$(%1$s __complete \"${(@)words[2,CURRENT]}\" 2>/dev/null)}\")\n"
+  "    if [[ \"${candidates[1]}\" == :file ]]; then\n"
+  "        _files\n"
+  "    else\n"
+  "        compadd -a candidates\n"
+  "    fi\n"
+  "}\n"
+  "compdef _%1$s %1$s\n";
+
+static const char complete_fish[] =
+  "function __%1$s_complete\n"
+  "    set -l candidates (%1$s __complete (commandline -opc)[2..-1] (commandline -ct) 2>/dev/null)\n"
+  "    if test \"$candidates[1]\" = :file\n"
+  "        __fish_complete_path (commandline -ct)\n"
+  "    else\n"
+  "        printf '%%s\\n' $candidates\n"
+  "    end\n"
+  "end\n"
+  "complete -c %1$s -f -a '(__%1$s_complete)'\n";
+
+// `prog __completion bash|zsh|fish` prints the glue script to source in that shell
+static int run_completion_script(const cli_app* app, const i32 argc, char** argv) {
+    const char* shell = argc > 0 ? argv[0] : "";
+    const char* script = STREQ(shell, "bash") ? complete_bash
+                         : STREQ(shell, "zsh") ? complete_zsh
+                         : STREQ(shell, "fish") ? complete_fish
+                                                : NULL;
+    if (script == NULL) {
+        fprintf(cli_stderr(), "error: unsupported shell '%s', expected bash, zsh or fish\n", shell);
+        return 1;
+    }
+
+    fprintf(cli_stdout(), script, app->name);
+    return 0;
+}
+
+#undef COUNT_OF
+
+/*********************************************************************/
+/* Spec dump                                                         */
+/*********************************************************************/
+
+// `prog __dump` prints the registered app in the spec format read by clic-gen, one definition per line:
+//
+//     app "name" "version" "description"
+//     batch
+//     default action_name
+//     command "names" action_name [ex] "help"
+//     option "names" flag|value|<type> [min..max] ["choice|..."] [required] [env "NAME"] [config "key"] "help"
+//     begin
+//     end
+//
+// Options belong to the command above them, or are global before the first command. Commands between `begin` and
+// `end` are subcommands of the one above `begin`, and are indented for readability. Action names can't be recovered
+// from function pointers, so they are derived from the first name of each command on the path; commands without an
+// action have `-` instead. `ex` marks a cli_action_ex. Lazy commands are set up first, so the dump is complete.
+
+static void dump_string(cli_writer* w, const char* str) {
+    cli_write(w, " \"", 2);
+    for (const char* c = str ? str : ""; *c; c++) {
+        if (*c == '"' || *c == '\\')
+            cli_write(w, "\\", 1);
+        if (*c == '\n')
+            cli_write(w, "\\n", 2);
+        else
+            cli_write(w, c, 1);
+    }
+    cli_write(w, "\"", 1);
+}
+
+static const char* const dump_type_names[] = {
+    [CLI_TYPE_STRING]   = "value",
+    [CLI_TYPE_INT]      = "int",
+    [CLI_TYPE_DOUBLE]   = "double",
+    [CLI_TYPE_BOOL]     = "bool",
+    [CLI_TYPE_ENUM]     = "enum",
+    [CLI_TYPE_SIZE]     = "size",
+    [CLI_TYPE_DURATION] = "duration",
+    [CLI_TYPE_PATH]     = "path",
+};
+
+static void dump_options(cli_writer* w, const cli_option* opts, u32 count, u32 depth) {
+    for (u32 i = 0; i < count; i++) {
+        cli_write_pad(w, ' ', depth * 4);
+        cli_write_str(w, "option");
+        dump_string(w, opts[i].names);
+        cli_write(w, " ", 1);
+        cli_write_str(w, opts[i].is_flag ? "flag" : dump_type_names[opts[i].type]);
+        if (opts[i].min != opts[i].max)
+            cli_writef(w, " %ld..%ld", opts[i].min, opts[i].max);
+        if (opts[i].choice_count > 0) {
+            cli_writer choices;
+            cli_writer_init(&choices, NULL, -1);
+            for (u32 c = 0; c < opts[i].choice_count; c++) {
+                if (c > 0)
+                    cli_write(&choices, "|", 1);
+                cli_write_str(&choices, opts[i].choices[c]);
+            }
+            cli_write(&choices, "", 1);
+            dump_string(w, choices.data);
+            cli_writer_free(&choices);
+        }
+        if (opts[i].required)
+            cli_write_str(w, " required");
+        if (opts[i].env != NULL) {
+            cli_write_str(w, " env");
+            dump_string(w, opts[i].env);
+        }
+        if (opts[i].config_key != NULL) {
+            cli_write_str(w, " config");
+            dump_string(w, opts[i].config_key);
+        }
+        dump_string(w, opts[i].help_text);
+        cli_write(w, "\n", 1);
+    }
+}
+
+static void dump_commands(const cli_app* app, cli_command* const* cmds, u32 count, command_path* path, cli_writer* w) {
+    for (u32 i = 0; i < count && path->depth < CLI_MAX_DEPTH; i++) {
+        const cli_command* cmd = cmds[i];
+        if (cmd->setup != NULL)
+            command_setup((cli_app*)app, path->depth > 0 ? path->items[path->depth - 1] : NULL, cmds[i]);
+        path->items[path->depth++] = cmd;
+
+        cli_write_pad(w, ' ', (path->depth - 1) * 4);
+        cli_write_str(w, "command");
+        dump_string(w, cmd->names);
+        bool has_action = cmd->action != NULL || cmd->action_ex != NULL;
+        cli_write_str(w, has_action ? " cmd" : " -");
+        for (u32 level = 0; has_action && level < path->depth; level++) {
+            const cli_name* name = &path->items[level]->name_list[0];
+            cli_write(w, "_", 1);
+            for (u32 c = 0; c < name->len; c++) {
+                char ch    = name->str[c];
+                bool ident = (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9');
+                cli_write(w, ident ? &ch : "_", 1);
+            }
+        }
+        if (cmd->action_ex != NULL)
+            cli_write_str(w, " ex");
+        dump_string(w, cmd->help_text);
+        cli_write(w, "\n", 1);
+        dump_options(w, cmd->options, cmd->option_count, path->depth - 1);
+
+        if (cmd->child_count > 0) {
+            cli_write_pad(w, ' ', (path->depth - 1) * 4);
+            cli_write_str(w, "begin\n");
+            dump_commands(app, cmd->children, cmd->child_count, path, w);
+            cli_write_pad(w, ' ', (path->depth - 1) * 4);
+            cli_write_str(w, "end\n");
+        }
+        path->depth--;
+    }
+}
+
+static int run_dump(const cli_app* app) {
+    cli_writer w;
+    cli_writer_init(&w, cli_stdout(), -1);
+
+    cli_write_str(&w, "app");
+    dump_string(&w, app->name);
+    dump_string(&w, app->version);
+    dump_string(&w, app->description);
+    cli_write(&w, "\n", 1);
+    if (app->batch_enabled)
+        cli_write_str(&w, "batch\n");
+    if (app->default_action != NULL)
+        cli_write_str(&w, "default cmd_default\n");
+    dump_options(&w, app->global_options, app->global_option_count, 0);
+
+    command_path path = {.depth = 0};
+    dump_commands(app, app->commands, app->command_count, &path, &w);
+
+    cli_writer_free(&w);
+    return 0;
+}
+
+// Remove macro definitions to avoid conflicts with files that include this header
+#undef ARENA_BASE
+#undef ALIGN_UP
+#undef KB
+#undef MB
+#undef PAGESIZE
 #undef MIN
 #undef MAX
 #undef ARENA_ALLOC
 #undef ARENA_ALLOC_ARRAY
-#undef MINIMUM_CAPACITY
+#undef BITSET_WORDS
 #undef STREQ
+#undef TRACE_COUNT
+#undef TRACE_BEGIN
+#undef TRACE_END
+#ifdef CLI_ENABLE_TRACE
+    #undef TRACE_ACTIVE
+#endif
 
-#endif  // End of implementation
\ No newline at end of file
+#endif  // End of implementation
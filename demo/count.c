@@ -0,0 +1,393 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "count.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define COUNT_X86
+#endif
+
+#define COUNT_READ_SIZE (1 << 20)
+
+// ' ', '\t', '\n', '\v', '\f', '\r'
+static inline bool is_space(u8 c) {
+    return c == ' ' || (u8)(c - '\t') < 5;
+}
+
+static void count_scalar(count_state* state, const u8* data, size_t len) {
+    u64 lines = 0, words = 0;
+    bool prev = state->prev_space;
+
+    for (size_t i = 0; i < len; i++) {
+        bool space = is_space(data[i]);
+        lines += data[i] == '\n';
+        words += prev && !space;
+        prev = space;
+    }
+
+    state->lines += lines;
+    state->words += words;
+    state->chars += len;
+    state->prev_space = prev;
+}
+
+// Fold one 64-byte block given its whitespace and newline bitmasks. A word starts wherever a non-space byte follows a
+// space byte, so shifting the space mask up by one (carrying in the previous block's last bit) lines each byte up with
+// its predecessor.
+static inline void count_masks(u64 space, u64 newline, u64* carry, u64* lines, u64* words) {
+    u64 starts = ~space & ((space << 1) | *carry);
+    *carry     = space >> 63;
+    *lines += (u64)__builtin_popcountll(newline);
+    *words += (u64)__builtin_popcountll(starts);
+}
+
+#ifdef COUNT_X86
+
+static inline u64 sse2_mask(__m128i v, __m128i* newline) {
+    const __m128i tab  = _mm_set1_epi8('\t');
+    const __m128i four = _mm_set1_epi8(4);
+    __m128i off        = _mm_sub_epi8(v, tab);
+    __m128i ctrl       = _mm_cmpeq_epi8(_mm_min_epu8(off, four), off);
+    __m128i space      = _mm_or_si128(ctrl, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+    *newline           = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+    return (u64)(u32)_mm_movemask_epi8(space);
+}
+
+static void count_sse2(count_state* state, const u8* data, size_t len) {
+    u64 lines = 0, words = 0;
+    u64 carry = state->prev_space ? 1 : 0;
+    size_t i  = 0;
+
+    for (; i + 64 <= len; i += 64) {
+        u64 space = 0, newline = 0;
+        for (int k = 0; k < 4; k++) {
+            __m128i nl;
+            __m128i v = _mm_loadu_si128((const __m128i*)(data + i + k * 16));
+            space |= sse2_mask(v, &nl) << (k * 16);
+            newline |= (u64)(u32)_mm_movemask_epi8(nl) << (k * 16);
+        }
+        count_masks(space, newline, &carry, &lines, &words);
+    }
+
+    state->lines += lines;
+    state->words += words;
+    state->chars += i;
+    state->prev_space = carry != 0;
+    count_scalar(state, data + i, len - i);
+}
+
+__attribute__((target("avx2"))) static inline u64 avx2_mask(__m256i v, u64* newline) {
+    const __m256i tab  = _mm256_set1_epi8('\t');
+    const __m256i four = _mm256_set1_epi8(4);
+    __m256i off        = _mm256_sub_epi8(v, tab);
+    __m256i ctrl       = _mm256_cmpeq_epi8(_mm256_min_epu8(off, four), off);
+    __m256i space      = _mm256_or_si256(ctrl, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+    *newline           = (u64)(u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+    return (u64)(u32)_mm256_movemask_epi8(space);
+}
+
+__attribute__((target("avx2,popcnt"))) static void count_avx2(count_state* state, const u8* data, size_t len) {
+    u64 lines = 0, words = 0;
+    u64 carry = state->prev_space ? 1 : 0;
+    size_t i  = 0;
+
+    for (; i + 64 <= len; i += 64) {
+        u64 nl_lo, nl_hi;
+        u64 lo    = avx2_mask(_mm256_loadu_si256((const __m256i*)(data + i)), &nl_lo);
+        u64 hi    = avx2_mask(_mm256_loadu_si256((const __m256i*)(data + i + 32)), &nl_hi);
+        u64 space = lo | (hi << 32);
+        count_masks(space, nl_lo | (nl_hi << 32), &carry, &lines, &words);
+    }
+
+    state->lines += lines;
+    state->words += words;
+    state->chars += i;
+    state->prev_space = carry != 0;
+    count_scalar(state, data + i, len - i);
+}
+
+#endif  // COUNT_X86
+
+typedef void (*count_kernel)(count_state*, const u8*, size_t);
+
+static count_kernel select_kernel(void) {
+#ifdef COUNT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return count_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return count_sse2;
+#endif
+    return count_scalar;
+}
+
+void count_buffer(count_state* state, const u8* data, size_t len) {
+    static count_kernel kernel = NULL;
+
+    count_kernel selected = __atomic_load_n(&kernel, __ATOMIC_RELAXED);
+    if (selected == NULL) {
+        selected = select_kernel();
+        __atomic_store_n(&kernel, selected, __ATOMIC_RELAXED);
+    }
+    selected(state, data, len);
+}
+
+static int count_fd_read(int fd, count_state* state) {
+    u8* buffer = (u8*)malloc(COUNT_READ_SIZE);
+    if (buffer == NULL)
+        return ENOMEM;
+
+    int result = 0;
+    for (;;) {
+        ssize_t n = read(fd, buffer, COUNT_READ_SIZE);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            result = errno;
+            break;
+        }
+        if (n == 0)
+            break;
+        count_buffer(state, buffer, (size_t)n);
+    }
+
+    free(buffer);
+    return result;
+}
+
+int count_file(const char* path, count_state* state) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return errno;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int result = errno;
+        close(fd);
+        return result;
+    }
+
+    int result = 0;
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+            count_buffer(state, (const u8*)data, (size_t)st.st_size);
+            munmap(data, (size_t)st.st_size);
+        } else {
+            result = count_fd_read(fd, state);
+        }
+    } else {
+        result = count_fd_read(fd, state);
+    }
+
+    close(fd);
+    return result;
+}
+
+/*********************************************************************/
+/* Multi-file and multi-core counting                                */
+/*********************************************************************/
+
+// Files at least twice this size are split into chunks of this size
+#define COUNT_CHUNK_SIZE ((size_t)64 << 20)
+
+typedef struct count_target count_target;
+
+typedef struct {
+    count_target* target;
+    size_t offset;
+    size_t len;
+    count_state counts;  // Counted as if the chunk were preceded by whitespace
+} count_chunk;
+
+struct count_target {
+    count_result* result;
+    const u8* data;  // Mapping of the whole file, NULL if the file is counted by a single task
+    size_t size;
+    int fd;
+    count_chunk* chunks;
+    u32 chunk_count;
+};
+
+static void count_list_push(count_list* list, const char* path) {
+    if (list->count == list->capacity) {
+        u32 capacity        = list->capacity ? list->capacity * 2 : 16;
+        count_result* items = (count_result*)realloc(list->items, sizeof(count_result) * capacity);
+        if (items == NULL)
+            cli_panic("error: failed to grow file list to %u entries", capacity);
+        list->items    = items;
+        list->capacity = capacity;
+    }
+
+    count_result* item = &list->items[list->count++];
+    memset(item, 0, sizeof(*item));
+    item->path              = strdup(path);
+    item->counts.prev_space = true;
+    if (item->path == NULL)
+        cli_panic("error: failed to copy path '%s'", path);
+}
+
+// Symlinks to directories are followed only when named directly, so a link back up the tree can't loop forever
+static void count_list_walk(count_list* list, const char* path, bool follow) {
+    struct stat st;
+    if (!follow && lstat(path, &st) == 0 && S_ISLNK(st.st_mode) && stat(path, &st) == 0 && S_ISDIR(st.st_mode))
+        return;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        // Errors are reported when the file is counted
+        count_list_push(list, path);
+        return;
+    }
+
+    struct dirent** entries;
+    int n = scandir(path, &entries, NULL, alphasort);
+    if (n < 0) {
+        count_list_push(list, path);
+        return;
+    }
+
+    size_t path_len = strlen(path);
+    for (int i = 0; i < n; i++) {
+        const char* name = entries[i]->d_name;
+        if (strcmp(name, ".") != 0 && strcmp(name, "..") != 0) {
+            size_t len  = path_len + strlen(name) + 2;
+            char* child = (char*)malloc(len);
+            if (child == NULL)
+                cli_panic("error: failed to allocate path");
+            snprintf(child, len, "%s%s%s", path, path[path_len - 1] == '/' ? "" : "/", name);
+            count_list_walk(list, child, false);
+            free(child);
+        }
+        free(entries[i]);
+    }
+    free(entries);
+}
+
+void count_list_add(count_list* list, const char* path) {
+    count_list_walk(list, path, true);
+}
+
+void count_list_free(count_list* list) {
+    for (u32 i = 0; i < list->count; i++) {
+        free(list->items[i].path);
+    }
+    free(list->items);
+    memset(list, 0, sizeof(*list));
+}
+
+static void count_whole_task(void* arg, u32 worker) {
+    (void)worker;
+    count_result* result = ((count_target*)arg)->result;
+    result->error        = count_file(result->path, &result->counts);
+}
+
+static void count_chunk_task(void* arg, u32 worker) {
+    (void)worker;
+    count_chunk* chunk = (count_chunk*)arg;
+    count_buffer(&chunk->counts, chunk->target->data + chunk->offset, chunk->len);
+}
+
+// Map large regular files and split them into chunks. Returns false if the file is counted as a whole.
+static bool count_target_split(count_target* target) {
+    struct stat st;
+    if (stat(target->result->path, &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size < 2 * COUNT_CHUNK_SIZE)
+        return false;
+
+    int fd = open(target->result->path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    target->fd          = fd;
+    target->data        = (const u8*)data;
+    target->size        = (size_t)st.st_size;
+    target->chunk_count = (u32)((target->size + COUNT_CHUNK_SIZE - 1) / COUNT_CHUNK_SIZE);
+    target->chunks      = (count_chunk*)calloc(target->chunk_count, sizeof(count_chunk));
+    if (target->chunks == NULL)
+        cli_panic("error: failed to allocate %u chunks", target->chunk_count);
+
+    for (u32 i = 0; i < target->chunk_count; i++) {
+        count_chunk* chunk       = &target->chunks[i];
+        chunk->target            = target;
+        chunk->offset            = (size_t)i * COUNT_CHUNK_SIZE;
+        chunk->len               = target->size - chunk->offset;
+        if (chunk->len > COUNT_CHUNK_SIZE)
+            chunk->len = COUNT_CHUNK_SIZE;
+        chunk->counts.prev_space = true;
+    }
+
+    return true;
+}
+
+// Each chunk counted a word start at its first byte if that byte is not whitespace. If the previous chunk ended
+// inside a word, that start was counted twice.
+static void count_target_merge(count_target* target) {
+    count_state* total = &target->result->counts;
+    for (u32 i = 0; i < target->chunk_count; i++) {
+        count_chunk* chunk = &target->chunks[i];
+        total->lines += chunk->counts.lines;
+        total->words += chunk->counts.words;
+        total->chars += chunk->counts.chars;
+        if (i > 0 && !target->chunks[i - 1].counts.prev_space && !is_space(target->data[chunk->offset]))
+            total->words--;
+    }
+    total->prev_space = target->chunks[target->chunk_count - 1].counts.prev_space;
+
+    munmap((void*)target->data, target->size);
+    close(target->fd);
+    free(target->chunks);
+}
+
+void count_list_run(count_list* list, u32 threads) {
+    count_target* targets = (count_target*)calloc(list->count, sizeof(count_target));
+    if (targets == NULL)
+        cli_panic("error: failed to allocate %u count targets", list->count);
+
+    u32 task_count = 0;
+    for (u32 i = 0; i < list->count; i++) {
+        targets[i].result = &list->items[i];
+        task_count += count_target_split(&targets[i]) ? targets[i].chunk_count : 1;
+    }
+
+    // Single small file: a pool would only add thread start-up cost
+    if (task_count == 1 || threads == 1) {
+        for (u32 i = 0; i < list->count; i++) {
+            if (targets[i].chunk_count == 0) {
+                count_whole_task(&targets[i], 0);
+                continue;
+            }
+            for (u32 k = 0; k < targets[i].chunk_count; k++) {
+                count_chunk_task(&targets[i].chunks[k], 0);
+            }
+        }
+    } else {
+        if (threads == 0)
+            threads = (u32)sysconf(_SC_NPROCESSORS_ONLN);
+        cli_pool* pool = cli_pool_create(threads < task_count ? threads : task_count);
+        for (u32 i = 0; i < list->count; i++) {
+            if (targets[i].chunk_count == 0) {
+                cli_pool_submit(pool, count_whole_task, &targets[i]);
+                continue;
+            }
+            for (u32 k = 0; k < targets[i].chunk_count; k++) {
+                cli_pool_submit(pool, count_chunk_task, &targets[i].chunks[k]);
+            }
+        }
+        cli_pool_wait(pool);
+        cli_pool_destroy(pool);
+    }
+
+    for (u32 i = 0; i < list->count; i++) {
+        if (targets[i].chunk_count > 0)
+            count_target_merge(&targets[i]);
+    }
+    free(targets);
+}
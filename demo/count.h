@@ -0,0 +1,40 @@
+#ifndef FILETOOL_COUNT_H
+#define FILETOOL_COUNT_H
+
+#include "../cli.h"
+
+// Running totals for line/word/char counting. Whitespace is classified like isspace() in the C locale.
+typedef struct {
+    u64 lines;
+    u64 words;
+    u64 chars;
+    bool prev_space;  // Whether the last byte seen was whitespace. Start with true.
+} count_state;
+
+// Count a buffer, continuing from `state`. Uses AVX2 or SSE2 when the CPU supports them.
+void count_buffer(count_state* state, const u8* data, size_t len);
+
+// Count a whole file. Regular files are memory-mapped, everything else is read in large blocks.
+int count_file(const char* path, count_state* state);
+
+typedef struct {
+    char* path;
+    count_state counts;
+    int error;  // errno value, 0 on success
+} count_result;
+
+typedef struct {
+    count_result* items;
+    u32 count;
+    u32 capacity;
+} count_list;
+
+// Add `path`, or every file below it (sorted by name) if it is a directory. Symlinked directories below it are skipped.
+void count_list_add(count_list* list, const char* path);
+void count_list_free(count_list* list);
+
+// Count every file in `list` on `threads` workers (0 = one per CPU). Large regular files are split into chunks that
+// are counted in parallel and merged.
+void count_list_run(count_list* list, u32 threads);
+
+#endif
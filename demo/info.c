@@ -0,0 +1,249 @@
+#define _GNU_SOURCE  // statx
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "info.h"
+
+#define INFO_BATCH_SIZE 512       // Paths per pool task
+#define INFO_READ_SIZE (64 << 10)  // Initial size of the path buffer
+
+void info_list_add(info_list* list, const char* path) {
+    if (list->count == list->capacity) {
+        u32 capacity       = list->capacity ? list->capacity * 2 : 64;
+        info_result* items = (info_result*)realloc(list->items, sizeof(info_result) * capacity);
+        if (items == NULL)
+            cli_panic("error: failed to grow path list to %u entries", capacity);
+        list->items    = items;
+        list->capacity = capacity;
+    }
+
+    info_result* item = &list->items[list->count++];
+    memset(item, 0, sizeof(*item));
+    item->path = path;
+}
+
+bool info_list_read(info_list* list, FILE* in) {
+    assert(list->storage == NULL);
+
+    size_t len = 0, capacity = INFO_READ_SIZE;
+    char* data = (char*)malloc(capacity);
+    if (data == NULL)
+        cli_panic("error: failed to allocate path buffer");
+
+    for (;;) {
+        len += fread(data + len, 1, capacity - len - 1, in);
+        if (len < capacity - 1)
+            break;
+        capacity *= 2;
+        if ((data = (char*)realloc(data, capacity)) == NULL)
+            cli_panic("error: failed to grow path buffer to %zu bytes", capacity);
+    }
+    data[len] = '\0';  // Terminates the last path if the input didn't
+
+    // Paths point into the buffer, so only split once it stops moving
+    list->storage = data;
+    for (size_t start = 0; start < len;) {
+        size_t end = start + strlen(data + start);
+        if (end > start)
+            info_list_add(list, data + start);
+        start = end + 1;
+    }
+
+    return !ferror(in);
+}
+
+void info_list_free(info_list* list) {
+    free(list->items);
+    free(list->storage);
+    memset(list, 0, sizeof(*list));
+}
+
+/*********************************************************************/
+/* Lookup                                                            */
+/*********************************************************************/
+
+typedef struct {
+    info_result* items;
+    u32 count;
+    u32 mask;
+} info_batch;
+
+static u32 info_statx_mask(u32 fields) {
+    u32 mask = STATX_TYPE;
+    if (fields & INFO_SIZE)
+        mask |= STATX_SIZE;
+    if (fields & INFO_MODE)
+        mask |= STATX_MODE;
+    if (fields & INFO_NLINK)
+        mask |= STATX_NLINK;
+    if (fields & INFO_INO)
+        mask |= STATX_INO;
+    if (fields & INFO_MTIME)
+        mask |= STATX_MTIME;
+
+    return mask;
+}
+
+static void info_batch_task(void* arg, u32 worker) {
+    (void)worker;
+    info_batch* batch = (info_batch*)arg;
+
+    for (u32 i = 0; i < batch->count; i++) {
+        info_result* item = &batch->items[i];
+        struct statx stx;
+        if (statx(AT_FDCWD, item->path, AT_STATX_SYNC_AS_STAT, batch->mask, &stx) != 0) {
+            item->error = errno;
+            continue;
+        }
+
+        item->mode  = stx.stx_mode;
+        item->nlink = stx.stx_nlink;
+        item->ino   = stx.stx_ino;
+        item->size  = stx.stx_size;
+        item->mtime = stx.stx_mtime.tv_sec;
+    }
+}
+
+void info_list_query(info_list* list, u32 fields, u32 threads) {
+    u32 batch_count = (list->count + INFO_BATCH_SIZE - 1) / INFO_BATCH_SIZE;
+    if (batch_count == 0)
+        return;
+
+    info_batch* batches = (info_batch*)malloc(sizeof(info_batch) * batch_count);
+    if (batches == NULL)
+        cli_panic("error: failed to allocate %u lookup batches", batch_count);
+
+    for (u32 i = 0; i < batch_count; i++) {
+        u32 start        = i * INFO_BATCH_SIZE;
+        batches[i].items = &list->items[start];
+        batches[i].count = list->count - start < INFO_BATCH_SIZE ? list->count - start : INFO_BATCH_SIZE;
+        batches[i].mask  = info_statx_mask(fields);
+    }
+
+    // A handful of paths is not worth starting threads for
+    if (batch_count == 1 || threads == 1) {
+        for (u32 i = 0; i < batch_count; i++) {
+            info_batch_task(&batches[i], 0);
+        }
+    } else {
+        if (threads == 0)
+            threads = (u32)sysconf(_SC_NPROCESSORS_ONLN);
+        cli_pool* pool = cli_pool_create(threads < batch_count ? threads : batch_count);
+        for (u32 i = 0; i < batch_count; i++) {
+            cli_pool_submit(pool, info_batch_task, &batches[i]);
+        }
+        cli_pool_wait(pool);
+        cli_pool_destroy(pool);
+    }
+
+    free(batches);
+}
+
+/*********************************************************************/
+/* Output                                                            */
+/*********************************************************************/
+
+// localtime_r takes the timezone lock on every call. Offsets and DST transitions fall on 15 minute boundaries, so
+// one conversion per 15 minute block is enough for every timestamp inside it.
+typedef struct {
+    i64 block;
+    struct tm tm;
+} info_time_cache;
+
+#define INFO_TIME_BLOCK 900
+
+static void info_put_uint(cli_writer* w, u64 value, u32 base, u32 min_digits) {
+    char digits[24];
+    u32 n = 0;
+    do {
+        digits[sizeof(digits) - ++n] = (char)('0' + value % base);
+        value /= base;
+    } while (value != 0 || n < min_digits);
+    cli_write(w, digits + sizeof(digits) - n, n);
+}
+
+static void info_put_time(cli_writer* w, info_time_cache* cache, i64 t) {
+    i64 block = t >= 0 ? t / INFO_TIME_BLOCK : (t - INFO_TIME_BLOCK + 1) / INFO_TIME_BLOCK;
+    if (block != cache->block) {
+        time_t start = (time_t)(block * INFO_TIME_BLOCK);
+        localtime_r(&start, &cache->tm);
+        cache->block = block;
+    }
+
+    struct tm tm = cache->tm;
+    u32 offset   = (u32)(t - block * INFO_TIME_BLOCK);
+    if (tm.tm_sec == 0 && tm.tm_min % 15 == 0) {
+        tm.tm_min += offset / 60;
+        tm.tm_sec = offset % 60;
+    } else {
+        // Odd historical offsets: no shortcut
+        time_t exact = (time_t)t;
+        localtime_r(&exact, &tm);
+    }
+
+    info_put_uint(w, (u64)(tm.tm_year + 1900), 10, 4);
+    cli_write(w, "-", 1);
+    info_put_uint(w, (u64)tm.tm_mon + 1, 10, 2);
+    cli_write(w, "-", 1);
+    info_put_uint(w, (u64)tm.tm_mday, 10, 2);
+    cli_write(w, " ", 1);
+    info_put_uint(w, (u64)tm.tm_hour, 10, 2);
+    cli_write(w, ":", 1);
+    info_put_uint(w, (u64)tm.tm_min, 10, 2);
+    cli_write(w, ":", 1);
+    info_put_uint(w, (u64)tm.tm_sec, 10, 2);
+}
+
+static const char* info_type_name(u32 mode) {
+    return S_ISDIR(mode) ? "directory" : S_ISREG(mode) ? "file" : S_ISLNK(mode) ? "symlink" : "other";
+}
+
+u32 info_list_print(const info_list* list, u32 fields, cli_writer* w, FILE* err) {
+    info_time_cache cache = {.block = INT64_MIN};
+    u32 errors            = 0;
+    for (u32 i = 0; i < list->count; i++) {
+        const info_result* item = &list->items[i];
+        if (item->error != 0) {
+            fprintf(err, "%s: %s\n", item->path, strerror(item->error));
+            errors++;
+            continue;
+        }
+
+        cli_write_str(w, item->path);
+        cli_write(w, "\n", 1);
+        if (fields & INFO_TYPE) {
+            cli_write_str(w, "  Type: ");
+            cli_write_str(w, info_type_name(item->mode));
+            cli_write(w, "\n", 1);
+        }
+        if (fields & INFO_SIZE) {
+            cli_write_str(w, "  Size: ");
+            info_put_uint(w, item->size, 10, 1);
+            cli_write_str(w, " bytes\n");
+        }
+        if (fields & INFO_MODE) {
+            cli_write_str(w, "  Mode: ");
+            info_put_uint(w, item->mode & 0777, 8, 1);
+            cli_write(w, "\n", 1);
+        }
+        if (fields & INFO_NLINK) {
+            cli_write_str(w, "  Links: ");
+            info_put_uint(w, item->nlink, 10, 1);
+            cli_write(w, "\n", 1);
+        }
+        if (fields & INFO_INO) {
+            cli_write_str(w, "  Inode: ");
+            info_put_uint(w, item->ino, 10, 1);
+            cli_write(w, "\n", 1);
+        }
+        if (fields & INFO_MTIME) {
+            cli_write_str(w, "  Modified: ");
+            info_put_time(w, &cache, item->mtime);
+            cli_write(w, "\n", 1);
+        }
+    }
+
+    return errors;
+}
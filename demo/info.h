@@ -0,0 +1,43 @@
+#ifndef FILETOOL_INFO_H
+#define FILETOOL_INFO_H
+
+#include "../cli.h"
+
+// Metadata fields that can be requested. Only the requested ones are fetched and printed.
+typedef enum {
+    INFO_TYPE  = 1 << 0,
+    INFO_SIZE  = 1 << 1,
+    INFO_MODE  = 1 << 2,
+    INFO_NLINK = 1 << 3,
+    INFO_INO   = 1 << 4,
+    INFO_MTIME = 1 << 5,
+} info_field;
+
+typedef struct {
+    const char* path;
+    int error;  // errno value, 0 on success
+    u32 mode;   // File type bits are always filled in, permission bits only with INFO_MODE
+    u32 nlink;
+    u64 ino;
+    u64 size;
+    i64 mtime;
+} info_result;
+
+typedef struct {
+    info_result* items;
+    u32 count;
+    u32 capacity;
+    char* storage;  // Backing store for paths read by info_list_read
+} info_list;
+
+void info_list_add(info_list* list, const char* path);  // `path` must outlive the list
+bool info_list_read(info_list* list, FILE* in);         // Append a NUL-delimited path list, false on read errors
+void info_list_free(info_list* list);
+
+// Look up `fields` for every path with statx, on `threads` workers (0 = one per CPU)
+void info_list_query(info_list* list, u32 fields, u32 threads);
+
+// Print results to `out` and lookup errors to `err`. Returns the number of errors.
+u32 info_list_print(const info_list* list, u32 fields, cli_writer* out, FILE* err);
+
+#endif
@@ -1,118 +1,232 @@
-#include <time.h>
-#include <ctype.h>
+#include <errno.h>
+
+#include "count.h"
+#include "info.h"
+#include "walk.h"
 
 #define CLI_IMPLEMENTATION
 #include "../cli.h"
 
-static i32 cmd_info(cli_option** opts, u32 opt_count) {
-    const char* path = NULL;
-    bool verbose     = false;
-
-    for (u32 i = 0; i < opt_count; i++) {
-        if (!opts[i]->is_present)
-            continue;
-        if (strstr(opts[i]->names, "--path"))
-            path = opts[i]->value;
-        if (strstr(opts[i]->names, "--verbose"))
-            verbose = true;
+// Option handles, set once in main() and read by the actions without searching for names
+static struct {
+    cli_opt path, null, threads, verbose;
+} info_opts;
+static struct {
+    cli_opt path, threads, lines, words, chars;
+} count_opts;
+static struct {
+    cli_opt path, threads;
+} du_opts;
+
+static i32 cmd_info(const cli_parse_result* result) {
+    const cli_option* paths = cli_is_present(result, info_opts.path) ? cli_option_of(result, info_opts.path) : NULL;
+    u32 threads             = (u32)cli_option_of(result, info_opts.threads)->as.integer;
+    bool verbose            = cli_is_present(result, info_opts.verbose);
+    bool from_stdin         = cli_is_present(result, info_opts.null);
+
+    if (paths == NULL && !from_stdin) {
+        fprintf(cli_stderr(), "error: no paths given, use --path or --null\n");
+        return 1;
     }
 
-    struct stat st;
-    if (stat(path, &st) != 0) {
-        perror(path);
+    info_list files = {0};
+    for (u32 i = 0; paths != NULL && i < paths->value_count; i++) {
+        info_list_add(&files, paths->values[i]);
+    }
+    if (from_stdin && !info_list_read(&files, stdin)) {
+        fprintf(cli_stderr(), "error: failed to read paths from stdin: %s\n", strerror(errno));
+        info_list_free(&files);
         return 1;
     }
 
-    const char* type = S_ISDIR(st.st_mode)   ? "directory"
-                       : S_ISREG(st.st_mode) ? "file"
-                       : S_ISLNK(st.st_mode) ? "symlink"
-                                             : "other";
-
-    printf("%s\n", path);
-    printf("  Type: %s\n", type);
-    printf("  Size: %ld bytes\n", (long)st.st_size);
+    // Only ask the kernel for what will be printed
+    u32 fields = INFO_TYPE | INFO_SIZE;
+    if (verbose)
+        fields |= INFO_MODE | INFO_NLINK | INFO_INO | INFO_MTIME;
 
-    if (verbose) {
-        printf("  Mode: %o\n", st.st_mode & 0777);
-        printf("  Links: %ld\n", (long)st.st_nlink);
-        printf("  Inode: %ld\n", (long)st.st_ino);
+    info_list_query(&files, fields, threads);
+    u32 errors = info_list_print(&files, fields, cli_out(), cli_stderr());
+    info_list_free(&files);
 
-        char timebuf[64];
-        strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S", localtime(&st.st_mtime));
-        printf("  Modified: %s\n", timebuf);
-    }
+    return errors > 0 ? 1 : 0;
+}
 
-    return 0;
+static void print_count(cli_writer* out, const char* label, u64 value) {
+    cli_write_str(out, label);
+    cli_write_u64(out, value);
+    cli_write(out, "\n", 1);
 }
 
-static i32 cmd_count(cli_option** opts, u32 opt_count) {
-    const char* path = NULL;
-    bool lines = false, words = false, chars = false;
+static void print_counts(cli_writer* out, const count_state* counts, bool lines, bool words, bool chars) {
+    if (lines)
+        print_count(out, "  Lines: ", counts->lines);
+    if (words)
+        print_count(out, "  Words: ", counts->words);
+    if (chars)
+        print_count(out, "  Chars: ", counts->chars);
+}
 
-    for (u32 i = 0; i < opt_count; i++) {
-        if (!opts[i]->is_present)
-            continue;
-        if (strstr(opts[i]->names, "--path"))
-            path = opts[i]->value;
-        if (strstr(opts[i]->names, "--lines"))
-            lines = true;
-        if (strstr(opts[i]->names, "--words"))
-            words = true;
-        if (strstr(opts[i]->names, "--chars"))
-            chars = true;
-    }
+static i32 cmd_count(const cli_parse_result* result) {
+    const cli_option* paths = cli_option_of(result, count_opts.path);  // Required, so always present
+    u32 threads             = (u32)cli_option_of(result, count_opts.threads)->as.integer;
+    bool lines              = cli_is_present(result, count_opts.lines);
+    bool words              = cli_is_present(result, count_opts.words);
+    bool chars              = cli_is_present(result, count_opts.chars);
 
     // Default to all if none specified
     if (!lines && !words && !chars) {
         lines = words = chars = true;
     }
 
-    FILE* f = fopen(path, "r");
-    if (!f) {
-        perror(path);
-        return 1;
+    count_list files = {0};
+    for (u32 i = 0; i < paths->value_count; i++) {
+        count_list_add(&files, paths->values[i]);
+    }
+    count_list_run(&files, threads);
+
+    // A single file keeps the plain output, several get a header per file and a total
+    cli_writer* out   = cli_out();
+    bool multiple     = files.count != 1;
+    i32 status        = 0;
+    count_state total = {0, 0, 0, true};
+    for (u32 i = 0; i < files.count; i++) {
+        const count_result* file = &files.items[i];
+        if (file->error != 0) {
+            fprintf(cli_stderr(), "%s: %s\n", file->path, strerror(file->error));
+            status = 1;
+            continue;
+        }
+
+        if (multiple) {
+            cli_write_str(out, file->path);
+            cli_write(out, "\n", 1);
+        }
+        print_counts(out, &file->counts, lines, words, chars);
+
+        total.lines += file->counts.lines;
+        total.words += file->counts.words;
+        total.chars += file->counts.chars;
+    }
+
+    if (multiple) {
+        cli_write_str(out, "total\n");
+        print_counts(out, &total, lines, words, chars);
     }
 
-    u64 line_count = 0, word_count = 0, char_count = 0;
-    int c, prev = ' ';
+    count_list_free(&files);
+    return status;
+}
 
-    while ((c = fgetc(f)) != EOF) {
-        char_count++;
-        if (c == '\n')
-            line_count++;
-        if (!isspace(c) && isspace(prev))
-            word_count++;
-        prev = c;
+static void print_usage(cli_writer* out, const walk_totals* totals) {
+    static const char* labels[WALK_TYPE_COUNT] = {"Files", "Directories", "Symlinks", "Other"};
+    u64 bytes = 0;
+    for (u32 t = 0; t < WALK_TYPE_COUNT; t++) {
+        cli_writef(out, "  %s: %lu (%lu bytes)\n", labels[t], totals->count[t], totals->bytes[t]);
+        bytes += totals->bytes[t];
     }
-    fclose(f);
+    if (totals->hard_links > 0)
+        cli_writef(out, "  Hard links: %lu (counted once)\n", totals->hard_links);
+    cli_writef(out, "  Size: %lu bytes\n", bytes);
+    cli_writef(out, "  Disk usage: %lu bytes\n", totals->disk_bytes);
+}
 
-    if (lines)
-        printf("  Lines: %lu\n", line_count);
-    if (words)
-        printf("  Words: %lu\n", word_count);
-    if (chars)
-        printf("  Chars: %lu\n", char_count);
+static i32 cmd_du(const cli_parse_result* result) {
+    const cli_option* paths = cli_option_of(result, du_opts.path);  // Required, so always present
+    u32 threads             = (u32)cli_option_of(result, du_opts.threads)->as.integer;
+
+    // One walker for all paths, so a file linked into several of them is only counted once
+    cli_writer* out   = cli_out();
+    walker* w         = walker_create(threads, cli_stderr());
+    walk_totals total = {0};
+    for (u32 i = 0; i < paths->value_count; i++) {
+        walk_totals totals;
+        walk_path(w, paths->values[i], &totals);
+
+        cli_writef(out, "%s\n", paths->values[i]);
+        print_usage(out, &totals);
+
+        for (u32 t = 0; t < WALK_TYPE_COUNT; t++) {
+            total.count[t] += totals.count[t];
+            total.bytes[t] += totals.bytes[t];
+        }
+        total.disk_bytes += totals.disk_bytes;
+        total.hard_links += totals.hard_links;
+        total.errors += totals.errors;
+    }
+    walker_destroy(w);
+
+    if (paths->value_count > 1) {
+        cli_write_str(out, "total\n");
+        print_usage(out, &total);
+    }
 
-    return 0;
+    return total.errors > 0 ? 1 : 0;
 }
 
+#ifdef FILETOOL_GENERATED
+    // A header generated by clic-gen from this program's own `__dump`, see gen/Makefile
+    #include FILETOOL_GENERATED
+
+int main(int argc, char* argv[]) {
+    cli_app* app = cli_app_create_static(&filetool_def);
+
+    info_opts.path     = cli_app_find_option(app, "info", "--path");
+    info_opts.null     = cli_app_find_option(app, "info", "--null");
+    info_opts.threads  = cli_app_find_option(app, "info", "--threads");
+    info_opts.verbose  = cli_app_find_option(app, "info", "--verbose");
+    count_opts.path    = cli_app_find_option(app, "count", "--path");
+    count_opts.threads = cli_app_find_option(app, "count", "--threads");
+    count_opts.lines   = cli_app_find_option(app, "count", "--lines");
+    count_opts.words   = cli_app_find_option(app, "count", "--words");
+    count_opts.chars   = cli_app_find_option(app, "count", "--chars");
+    du_opts.path       = cli_app_find_option(app, "du", "--path");
+    du_opts.threads    = cli_app_find_option(app, "du", "--threads");
+#else
 int main(int argc, char* argv[]) {
     cli_app* app = cli_app_create("filetool", "1.0.0", "A file utility showcasing the clic library", NULL);
+    cli_app_enable_batch(app, true);
+
+    // Value types shared by the commands below
+    static const cli_option_type path    = {.type = CLI_TYPE_PATH};
+    static const cli_option_type threads = {.type = CLI_TYPE_INT, .min = 0, .max = 1024};
 
     // `info` command
-    cli_command* info = cli_app_add_command(app, "info, i", cmd_info, "Display information about a file or directory");
-    cli_cmd_add_option(app, info, "-p, --path", true, false, "Path to inspect");
-    cli_cmd_add_option(app, info, "-v, --verbose", false, true, "Show extended information");
+    cli_command* info =
+      cli_app_add_command_ex(app, "info, i", cmd_info, "Display information about a file or directory");
+    info_opts.path = cli_cmd_add_typed_option(app, info, "-p, --path", false, &path, "Path to inspect (repeatable)");
+    info_opts.null =
+      cli_cmd_add_option(app, info, "-0, --null", false, true, "Also read NUL-delimited paths from stdin");
+    info_opts.threads =
+      cli_cmd_add_typed_option(app, info, "-t, --threads", false, &threads, "Worker threads (default: one per CPU)");
+    info_opts.verbose = cli_cmd_add_option(app, info, "-v, --verbose", false, true, "Show extended information");
 
     // `count` command
-    cli_command* count = cli_app_add_command(app, "count, c", cmd_count, "Count lines, words, and characters");
-    cli_cmd_add_option(app, count, "-p, --path", true, false, "File to analyze");
-    cli_cmd_add_option(app, count, "-l, --lines", false, true, "Count lines only");
-    cli_cmd_add_option(app, count, "-w, --words", false, true, "Count words only");
-    cli_cmd_add_option(app, count, "-c, --chars", false, true, "Count characters only");
+    cli_command* count = cli_app_add_command_ex(app, "count, c", cmd_count, "Count lines, words, and characters");
+    count_opts.path =
+      cli_cmd_add_typed_option(app, count, "-p, --path", true, &path, "File or directory to analyze (repeatable)");
+    count_opts.threads =
+      cli_cmd_add_typed_option(app, count, "-t, --threads", false, &threads, "Worker threads (default: one per CPU)");
+    count_opts.lines = cli_cmd_add_option(app, count, "-l, --lines", false, true, "Count lines only");
+    count_opts.words = cli_cmd_add_option(app, count, "-w, --words", false, true, "Count words only");
+    count_opts.chars = cli_cmd_add_option(app, count, "-c, --chars", false, true, "Count characters only");
+
+    // `du` command
+    cli_command* du = cli_app_add_command_ex(app, "du", cmd_du, "Summarize disk usage of directory trees");
+    du_opts.path =
+      cli_cmd_add_typed_option(app, du, "-p, --path", true, &path, "File or directory to walk (repeatable)");
+    du_opts.threads =
+      cli_cmd_add_typed_option(app, du, "-t, --threads", false, &threads, "Worker threads (default: one per CPU)");
+
+    // Thread counts not given on the command line come from the environment, then the config file
+    cli_app_set_option_source(app, info_opts.threads, "FILETOOL_THREADS", "info.threads");
+    cli_app_set_option_source(app, count_opts.threads, "FILETOOL_THREADS", "count.threads");
+    cli_app_set_option_source(app, du_opts.threads, "FILETOOL_THREADS", "du.threads");
+#endif
+    cli_app_set_config(app, getenv("FILETOOL_CONFIG"));
 
     int result = cli_app_run(app, argc, argv);
     cli_app_destroy(app);
+    cli_thread_arena_release();
 
     return result;
 }
\ No newline at end of file
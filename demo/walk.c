@@ -0,0 +1,322 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/syscall.h>
+
+#include "walk.h"
+
+#define WALK_SHARD_COUNT 64
+#define WALK_DENTS_SIZE (64 << 10)
+
+// Layout of the records returned by getdents64
+typedef struct {
+    u64 d_ino;
+    i64 d_off;
+    u16 d_reclen;
+    u8 d_type;
+    char d_name[];
+} walk_dirent;
+
+/*********************************************************************/
+/* Hard link set                                                     */
+/*********************************************************************/
+
+// Only inodes with more than one link are recorded, so the set stays small on typical trees
+typedef struct {
+    u64 dev;
+    u64 ino;
+} walk_inode;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    walk_inode* slots;  // Open addressing, (0, 0) marks an empty slot
+    u32 count;
+    u32 capacity;  // Always a power of two
+} walk_shard;
+
+static inline u64 walk_inode_hash(u64 dev, u64 ino) {
+    u64 h = (ino ^ (dev << 32 | dev >> 32)) * 0x9e3779b97f4a7c15ull;
+    return h ^ (h >> 29);
+}
+
+static void walk_shard_grow(walk_shard* shard) {
+    u32 capacity      = shard->capacity ? shard->capacity * 2 : 256;
+    walk_inode* slots = (walk_inode*)calloc(capacity, sizeof(walk_inode));
+    if (slots == NULL)
+        cli_panic("error: failed to grow inode set to %u entries", capacity);
+
+    for (u32 i = 0; i < shard->capacity; i++) {
+        walk_inode* inode = &shard->slots[i];
+        if (inode->dev == 0 && inode->ino == 0)
+            continue;
+        u32 slot = (u32)walk_inode_hash(inode->dev, inode->ino) & (capacity - 1);
+        while (slots[slot].dev != 0 || slots[slot].ino != 0) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        slots[slot] = *inode;
+    }
+
+    free(shard->slots);
+    shard->slots    = slots;
+    shard->capacity = capacity;
+}
+
+// Returns false if the inode was already in the set
+static bool walk_inode_insert(walk_shard* shards, u64 dev, u64 ino) {
+    u64 hash          = walk_inode_hash(dev, ino);
+    walk_shard* shard = &shards[(hash >> 32) % WALK_SHARD_COUNT];  // High bits pick the shard, low bits the slot
+
+    pthread_mutex_lock(&shard->mutex);
+    if ((shard->count + 1) * 2 > shard->capacity)
+        walk_shard_grow(shard);
+
+    bool inserted = true;
+    u32 slot      = (u32)hash & (shard->capacity - 1);
+    for (;;) {
+        walk_inode* inode = &shard->slots[slot];
+        if (inode->dev == dev && inode->ino == ino) {
+            inserted = false;
+            break;
+        }
+        if (inode->dev == 0 && inode->ino == 0) {
+            inode->dev = dev;
+            inode->ino = ino;
+            shard->count++;
+            break;
+        }
+        slot = (slot + 1) & (shard->capacity - 1);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+
+    return inserted;
+}
+
+/*********************************************************************/
+/* Walker                                                            */
+/*********************************************************************/
+
+// Padded so workers never share a cache line while counting
+typedef struct {
+    _Alignas(64) walk_totals totals;
+} walk_worker;
+
+struct walker {
+    cli_pool* pool;
+    walk_worker* workers;
+    FILE* err;
+    walk_shard shards[WALK_SHARD_COUNT];
+};
+
+// A directory waiting to be read or being read. Children are opened relative to `fd`, so full paths are never built
+// except for error messages. Each node holds a reference on its parent, which keeps the names above it for those
+// messages, and an fd reference that is dropped as soon as it has been opened. A directory's fd is closed once it
+// has been read and every subdirectory in it has been opened, however long those take to finish.
+typedef struct walk_node walk_node;
+struct walk_node {
+    walker* w;
+    walk_node* parent;
+    atomic_uint refs;
+    atomic_uint fd_refs;  // The node's own read, plus children not yet opened
+    int fd;
+    char name[];
+};
+
+walker* walker_create(u32 threads, FILE* err) {
+    walker* w = (struct walker*)calloc(1, sizeof(struct walker));
+    if (w == NULL)
+        cli_panic("error: failed to allocate walker");
+
+    w->pool    = cli_pool_create(threads);
+    w->err     = err;
+    w->workers = (walk_worker*)aligned_alloc(64, sizeof(walk_worker) * cli_pool_size(w->pool));
+    if (w->workers == NULL)
+        cli_panic("error: failed to allocate walker");
+    memset(w->workers, 0, sizeof(walk_worker) * cli_pool_size(w->pool));
+
+    for (u32 i = 0; i < WALK_SHARD_COUNT; i++) {
+        pthread_mutex_init(&w->shards[i].mutex, NULL);
+    }
+
+    return w;
+}
+
+void walker_destroy(walker* w) {
+    cli_pool_destroy(w->pool);
+    for (u32 i = 0; i < WALK_SHARD_COUNT; i++) {
+        pthread_mutex_destroy(&w->shards[i].mutex);
+        free(w->shards[i].slots);
+    }
+    free(w->workers);
+    free(w);
+}
+
+static walk_node* walk_node_create(walker* w, walk_node* parent, const char* name) {
+    size_t len      = strlen(name) + 1;
+    walk_node* node = (walk_node*)malloc(sizeof(walk_node) + len);
+    if (node == NULL)
+        cli_panic("error: failed to allocate directory node");
+
+    node->w = w;
+    node->parent = parent;
+    node->fd     = -1;
+    atomic_init(&node->refs, 1);
+    atomic_init(&node->fd_refs, 1);
+    memcpy(node->name, name, len);
+    if (parent != NULL) {
+        atomic_fetch_add(&parent->refs, 1);
+        atomic_fetch_add(&parent->fd_refs, 1);
+    }
+
+    return node;
+}
+
+static void walk_node_release(walk_node* node) {
+    while (node != NULL && atomic_fetch_sub(&node->refs, 1) == 1) {
+        walk_node* parent = node->parent;
+        free(node);
+        node = parent;
+    }
+}
+
+static void walk_node_release_fd(walk_node* node) {
+    if (node != NULL && atomic_fetch_sub(&node->fd_refs, 1) == 1 && node->fd >= 0)
+        close(node->fd);
+}
+
+static size_t walk_node_path(const walk_node* node, char* buf, size_t size) {
+    size_t len = node->parent ? walk_node_path(node->parent, buf, size) : 0;
+    if (len > 0 && len < size && buf[len - 1] != '/')
+        buf[len++] = '/';
+    if (len < size)
+        len += (size_t)snprintf(buf + len, size - len, "%s", node->name);
+
+    return len < size ? len : size - 1;
+}
+
+// `name` is an entry of `dir`, or NULL if the error is about `dir` itself
+static void walk_error(walk_totals* totals, const walk_node* dir, const char* name, int error) {
+    char path[PATH_MAX];
+    size_t len = walk_node_path(dir, path, sizeof(path));
+    if (name != NULL)
+        snprintf(path + len, sizeof(path) - len, "%s%s", len > 0 && path[len - 1] == '/' ? "" : "/", name);
+
+    fprintf(dir->w->err, "%s: %s\n", path, strerror(error));
+    totals->errors++;
+}
+
+static walk_type walk_type_of(mode_t mode) {
+    return S_ISREG(mode) ? WALK_FILE : S_ISDIR(mode) ? WALK_DIR : S_ISLNK(mode) ? WALK_SYMLINK : WALK_OTHER;
+}
+
+static void walk_account(walker* w, walk_totals* totals, const struct stat* st) {
+    if (!S_ISDIR(st->st_mode) && st->st_nlink > 1 && !walk_inode_insert(w->shards, st->st_dev, st->st_ino)) {
+        totals->hard_links++;
+        return;
+    }
+
+    walk_type type = walk_type_of(st->st_mode);
+    totals->count[type]++;
+    totals->bytes[type] += (u64)st->st_size;
+    totals->disk_bytes += (u64)st->st_blocks * 512;
+}
+
+static void walk_dir_task(void* arg, u32 worker);
+
+static void walk_read_dir(walk_node* node, walk_totals* totals) {
+    _Alignas(8) char buf[WALK_DENTS_SIZE];
+
+    for (;;) {
+        long n = syscall(SYS_getdents64, node->fd, buf, sizeof(buf));
+        if (n <= 0) {
+            if (n < 0)
+                walk_error(totals, node, NULL, errno);
+            return;
+        }
+
+        for (long pos = 0; pos < n;) {
+            const walk_dirent* entry = (const walk_dirent*)(buf + pos);
+            const char* name         = entry->d_name;
+            pos += entry->d_reclen;
+
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                continue;
+
+            // Subdirectories stat themselves once opened
+            if (entry->d_type == DT_DIR) {
+                cli_pool_submit(node->w->pool, walk_dir_task, walk_node_create(node->w, node, name));
+                continue;
+            }
+
+            struct stat st;
+            if (fstatat(node->fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                walk_error(totals, node, name, errno);
+                continue;
+            }
+
+            // Filesystems that don't fill in d_type
+            if (S_ISDIR(st.st_mode)) {
+                cli_pool_submit(node->w->pool, walk_dir_task, walk_node_create(node->w, node, name));
+                continue;
+            }
+
+            walk_account(node->w, totals, &st);
+        }
+    }
+}
+
+static void walk_dir_task(void* arg, u32 worker) {
+    walk_node* node     = (walk_node*)arg;
+    walker* w           = node->w;
+    walk_totals* totals = &w->workers[worker].totals;
+    int parent_fd       = node->parent ? node->parent->fd : AT_FDCWD;
+
+    struct stat st;
+    node->fd = openat(parent_fd, node->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (node->fd < 0) {
+        walk_error(totals, node, NULL, errno);
+        // The directory itself still takes up space
+        if (fstatat(parent_fd, node->name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+            walk_account(w, totals, &st);
+        walk_node_release_fd(node->parent);
+    } else {
+        walk_node_release_fd(node->parent);
+        if (fstat(node->fd, &st) != 0) {
+            walk_error(totals, node, NULL, errno);
+        } else {
+            walk_account(w, totals, &st);
+            walk_read_dir(node, totals);
+        }
+    }
+
+    walk_node_release_fd(node);
+    walk_node_release(node);
+}
+
+void walk_path(walker* w, const char* path, walk_totals* totals) {
+    walk_totals* first = &w->workers[0].totals;
+
+    struct stat st;
+    if (fstatat(AT_FDCWD, path, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        fprintf(w->err, "%s: %s\n", path, strerror(errno));
+        first->errors++;
+    } else if (S_ISDIR(st.st_mode)) {
+        cli_pool_submit(w->pool, walk_dir_task, walk_node_create(w, NULL, path));
+        cli_pool_wait(w->pool);
+    } else {
+        walk_account(w, first, &st);
+    }
+
+    // Collect and reset the per-worker totals
+    memset(totals, 0, sizeof(*totals));
+    for (u32 i = 0; i < cli_pool_size(w->pool); i++) {
+        walk_totals* worker = &w->workers[i].totals;
+        for (u32 t = 0; t < WALK_TYPE_COUNT; t++) {
+            totals->count[t] += worker->count[t];
+            totals->bytes[t] += worker->bytes[t];
+        }
+        totals->disk_bytes += worker->disk_bytes;
+        totals->hard_links += worker->hard_links;
+        totals->errors += worker->errors;
+        memset(worker, 0, sizeof(*worker));
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef FILETOOL_WALK_H
+#define FILETOOL_WALK_H
+
+#include "../cli.h"
+
+typedef enum {
+    WALK_FILE,
+    WALK_DIR,
+    WALK_SYMLINK,
+    WALK_OTHER,
+    WALK_TYPE_COUNT,
+} walk_type;
+
+typedef struct {
+    u64 count[WALK_TYPE_COUNT];
+    u64 bytes[WALK_TYPE_COUNT];  // Apparent size (st_size)
+    u64 disk_bytes;              // Allocated size (st_blocks * 512)
+    u64 hard_links;              // Entries skipped because their inode was already counted
+    u64 errors;
+} walk_totals;
+
+// Walks directory trees on a work-stealing pool. Hard-linked files are counted once across every walk_path() call
+// on the same walker.
+typedef struct walker walker;
+
+walker* walker_create(u32 threads, FILE* err);  // threads: 0 = one per CPU. Errors are reported to `err`.
+void walker_destroy(walker* w);
+
+// Add up everything below `path` (or `path` itself if it is not a directory) into `totals`. Symlinks are not followed.
+void walk_path(walker* w, const char* path, walk_totals* totals);
+
+#endif
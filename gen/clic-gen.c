@@ -0,0 +1,998 @@
+/*
+    clic-gen - compile a CLI spec into a header with perfect-hash lookup and precomputed help
+
+        clic-gen [-p prefix] [-o header] [-c cases] spec
+        clic-gen [-p prefix] [-o header] [-c cases] --from program
+
+    The spec is the format printed by `program __dump` (see "Spec dump" in cli.h); --from runs the program to get
+    it. The header defines `static const cli_app_def <prefix>_def`, where every command and option name is found
+    with one hash and one comparison, and help that fits the terminal is written without being laid out. Include
+    it after cli.h and after declaring every action the spec names:
+
+        cli_app* app = cli_app_create_static(&<prefix>_def);
+
+    With -c, argument lists exercising every name are written one per line, ready for `program --batch`. Running
+    them through the generated and the registered app must give the same output.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#define CLI_IMPLEMENTATION
+#include "../cli.h"
+
+#define GEN_MAX_SEED 100000000u  // Give up on a bucket after this many seeds
+#define GEN_OWNER_SALT 0x9e3779b9u
+
+// Mirrors the owner mixing in the generated find_command() and find_option()
+static inline u32 gen_owner_hash(u32 hash, u32 owner) {
+    return hash ^ (owner + 1) * GEN_OWNER_SALT;
+}
+
+static inline u32 gen_max(u32 a, u32 b) {
+    return a > b ? a : b;
+}
+
+static i32 gen_action(cli_option** opts, u32 opt_count) {
+    (void)opts;
+    (void)opt_count;
+    return 0;
+}
+
+static i32 gen_action_ex(const cli_parse_result* result) {
+    (void)result;
+    return 0;
+}
+
+static cli_action gen_default_action = gen_action;
+
+/*********************************************************************/
+/* Spec                                                              */
+/*********************************************************************/
+
+typedef struct {
+    cli_app* app;
+    const char* default_action;
+    const char** actions;  // Per command, in spec order
+    u32 command_count;
+    u32 action_capacity;
+} gen_spec;
+
+// Splits the next word off `*cursor`, unquoting it in place. Returns NULL at the end of the line.
+static char* spec_word(char** cursor, u32 line) {
+    char* c = *cursor;
+    while (*c == ' ' || *c == '\t' || *c == '\r')
+        c++;
+    if (*c == '\0' || *c == '#')
+        return NULL;
+
+    char* word = c;
+    if (*c != '"') {
+        while (*c && *c != ' ' && *c != '\t' && *c != '\r')
+            c++;
+        if (*c)
+            *c++ = '\0';
+        *cursor = c;
+        return word;
+    }
+
+    char* out = word;
+    for (c++; *c != '"'; c++) {
+        if (*c == '\\' && c[1] != '\0') {
+            c++;
+            *out++ = *c == 'n' ? '\n' : *c;
+            continue;
+        }
+        if (*c == '\0') {
+            fprintf(stderr, "error: line %u: unterminated string\n", line);
+            exit(1);
+        }
+        *out++ = *c;
+    }
+    *out    = '\0';
+    *cursor = c + 1;
+    return word;
+}
+
+static char* spec_expect(char** cursor, u32 line, const char* what) {
+    char* word = spec_word(cursor, line);
+    if (word == NULL) {
+        fprintf(stderr, "error: line %u: expected %s\n", line, what);
+        exit(1);
+    }
+    return word;
+}
+
+// "a|b|c" split in place into the choices of an enum option, allocated with the app
+static const char* const* spec_split_choices(cli_app* app, char* text, u32* count) {
+    *count = 1;
+    for (const char* c = text; *c; c++) {
+        *count += *c == '|';
+    }
+
+    const char** choices = (const char**)arena_push(app->arena, sizeof(char*) * *count, false);
+    for (u32 i = 0; i < *count; i++) {
+        choices[i] = text;
+        text += strcspn(text, "|");
+        *text++ = '\0';
+    }
+    return choices;
+}
+
+// Registers the spec on a regular app, so lookups, first-registration-wins and help come from the same code the
+// runtime uses. `text` must outlive the app.
+static void spec_parse(gen_spec* spec, char* text) {
+    cli_command* cmd = NULL;
+    cli_command* parents[CLI_MAX_DEPTH];  // Commands whose `begin` is still open
+    u32 depth = 0;
+    u32 line  = 0;
+    for (char* next = text; next != NULL;) {
+        char* cursor = next;
+        next         = strchr(next, '\n');
+        if (next != NULL)
+            *next++ = '\0';
+        line++;
+
+        const char* keyword = spec_word(&cursor, line);
+        if (keyword == NULL)
+            continue;
+
+        if (strcmp(keyword, "app") == 0) {
+            const char* name        = spec_expect(&cursor, line, "an app name");
+            const char* version     = spec_expect(&cursor, line, "a version");
+            const char* description = spec_expect(&cursor, line, "a description");
+            spec->app               = cli_app_create(name, version, description, NULL);
+            continue;
+        }
+        if (spec->app == NULL) {
+            fprintf(stderr, "error: line %u: the spec must start with an 'app' line\n", line);
+            exit(1);
+        }
+
+        if (strcmp(keyword, "batch") == 0) {
+            cli_app_enable_batch(spec->app, true);
+        } else if (strcmp(keyword, "default") == 0) {
+            spec->default_action      = spec_expect(&cursor, line, "an action name");
+            spec->app->default_action = &gen_default_action;
+        } else if (strcmp(keyword, "command") == 0) {
+            const char* names  = spec_expect(&cursor, line, "command names");
+            const char* action = spec_expect(&cursor, line, "an action name");
+            const char* help   = spec_expect(&cursor, line, "help text");
+            cli_command* owner = depth ? parents[depth - 1] : NULL;
+            if (strcmp(help, "ex") == 0) {
+                help = spec_expect(&cursor, line, "help text");
+                cmd  = cli_cmd_add_command_ex(spec->app, owner, names, gen_action_ex, help);
+            } else {
+                cli_action fn = strcmp(action, "-") != 0 ? gen_action : NULL;
+                cmd           = cli_cmd_add_command(spec->app, owner, names, fn, help);
+            }
+
+            if (++spec->command_count > spec->action_capacity) {
+                spec->action_capacity = spec->action_capacity ? spec->action_capacity * 2 : 64;
+                spec->actions = (const char**)realloc(spec->actions, sizeof(const char*) * spec->action_capacity);
+                if (spec->actions == NULL)
+                    cli_panic("error: failed to grow action table to %u entries", spec->action_capacity);
+            }
+            spec->actions[spec->command_count - 1] = action;
+        } else if (strcmp(keyword, "begin") == 0) {
+            if (cmd == NULL) {
+                fprintf(stderr, "error: line %u: 'begin' must follow a command\n", line);
+                exit(1);
+            }
+            if (depth + 1 == CLI_MAX_DEPTH) {
+                fprintf(stderr, "error: line %u: commands nest deeper than %u levels\n", line, CLI_MAX_DEPTH);
+                exit(1);
+            }
+            parents[depth++] = cmd;
+            cmd              = NULL;
+        } else if (strcmp(keyword, "end") == 0) {
+            if (depth == 0) {
+                fprintf(stderr, "error: line %u: 'end' without 'begin'\n", line);
+                exit(1);
+            }
+            cmd = parents[--depth];
+        } else if (strcmp(keyword, "option") == 0) {
+            const char* names = spec_expect(&cursor, line, "option names");
+            const char* kind  = spec_expect(&cursor, line, "'flag', 'value' or a type");
+            char* help        = spec_expect(&cursor, line, "help text");
+            bool required     = false;
+
+            cli_option_type type = {CLI_TYPE_STRING};
+            u32 type_count       = sizeof(dump_type_names) / sizeof(dump_type_names[0]);
+            while (type.type < type_count && strcmp(kind, dump_type_names[type.type]) != 0)
+                type.type++;
+            if (strcmp(kind, "flag") != 0 && type.type == type_count) {
+                fprintf(stderr, "error: line %u: expected 'flag', 'value' or a type, got '%s'\n", line, kind);
+                exit(1);
+            }
+
+            int used = 0;
+            if (sscanf(help, "%ld..%ld%n", &type.min, &type.max, &used) == 2 && help[used] == '\0')
+                help = spec_expect(&cursor, line, "help text");
+            if (type.type == CLI_TYPE_ENUM) {
+                type.choices = spec_split_choices(spec->app, help, &type.choice_count);
+                help         = spec_expect(&cursor, line, "help text");
+            }
+            if (strcmp(help, "required") == 0) {
+                required = true;
+                help     = spec_expect(&cursor, line, "help text");
+            }
+            const char* env        = NULL;
+            const char* config_key = NULL;
+            if (strcmp(help, "env") == 0) {
+                env  = spec_expect(&cursor, line, "an environment variable");
+                help = spec_expect(&cursor, line, "help text");
+            }
+            if (strcmp(help, "config") == 0) {
+                config_key = spec_expect(&cursor, line, "a config key");
+                help       = spec_expect(&cursor, line, "help text");
+            }
+            if (cmd == NULL && depth > 0) {
+                fprintf(stderr, "error: line %u: option before the first subcommand\n", line);
+                exit(1);
+            }
+
+            cli_opt handle;
+            if (strcmp(kind, "flag") == 0 || type.type == CLI_TYPE_STRING)
+                handle = cli_cmd_add_option(spec->app, cmd, names, required, strcmp(kind, "flag") == 0, help);
+            else
+                handle = cli_cmd_add_typed_option(spec->app, cmd, names, required, &type, help);
+            if (env != NULL || config_key != NULL)
+                cli_app_set_option_source(spec->app, handle, env, config_key);
+        } else {
+            fprintf(stderr, "error: line %u: unknown definition '%s'\n", line, keyword);
+            exit(1);
+        }
+
+        if (spec_word(&cursor, line) != NULL) {
+            fprintf(stderr, "error: line %u: trailing words after '%s'\n", line, keyword);
+            exit(1);
+        }
+    }
+
+    if (spec->app == NULL) {
+        fprintf(stderr, "error: empty spec\n");
+        exit(1);
+    }
+    if (depth > 0) {
+        fprintf(stderr, "error: missing 'end' for '%s'\n", parents[depth - 1]->names);
+        exit(1);
+    }
+}
+
+static char* read_all(int fd, const char* source) {
+    size_t len = 0, capacity = 64 << 10;
+    char* data = (char*)malloc(capacity);
+    for (;;) {
+        if (data == NULL)
+            cli_panic("error: failed to grow spec buffer to %zu bytes", capacity);
+        ssize_t n = read(fd, data + len, capacity - len - 1);
+        if (n < 0) {
+            fprintf(stderr, "error: failed to read %s: %s\n", source, strerror(errno));
+            exit(1);
+        }
+        if (n == 0)
+            break;
+        len += (size_t)n;
+        if (len == capacity - 1)
+            data = (char*)realloc(data, capacity *= 2);
+    }
+    data[len] = '\0';
+    return data;
+}
+
+// Runs `program __dump` and returns what it printed
+static char* read_dump(const char* program) {
+    int fds[2];
+    if (pipe(fds) != 0)
+        cli_panic("error: failed to create pipe: %s", strerror(errno));
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execlp(program, program, "__dump", (char*)NULL);
+        fprintf(stderr, "error: failed to run %s: %s\n", program, strerror(errno));
+        _exit(127);
+    }
+    close(fds[1]);
+
+    char* text = read_all(fds[0], program);
+    close(fds[0]);
+
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "error: '%s __dump' failed\n", program);
+        exit(1);
+    }
+    return text;
+}
+
+/*********************************************************************/
+/* Perfect hash                                                      */
+/*********************************************************************/
+
+typedef struct {
+    u32 hash;    // Key hash the table is built over
+    u32 name;    // Index into the emitted names array
+    u32 owner;   // Index of the parent command or of the option's command, the command count at the top level
+    u32 target;  // Command index, or option index into the emitted options array
+} gen_key;
+
+typedef struct {
+    gen_key* keys;  // Unique hashes only, in slot order once built
+    u32 count;
+    u32* seeds;
+    u32 seed_count;
+    gen_key* overflow;  // Keys whose hash collides with one already in the table. Scanned after a miss.
+    u32 overflow_count;
+} gen_table;
+
+static int key_compare_hash(const void* a, const void* b) {
+    u32 x = ((const gen_key*)a)->hash, y = ((const gen_key*)b)->hash;
+    return x < y ? -1 : x > y;
+}
+
+typedef struct {
+    u32 bucket;
+    u32 size;
+} gen_bucket;
+
+static int bucket_compare_size(const void* a, const void* b) {
+    const gen_bucket* x = (const gen_bucket*)a;
+    const gen_bucket* y = (const gen_bucket*)b;
+    return x->size != y->size ? (x->size > y->size ? -1 : 1) : (x->bucket > y->bucket) - (x->bucket < y->bucket);
+}
+
+// Hash and displace: keys are grouped into buckets of about four, and the largest buckets pick a seed first, trying
+// seeds until every key of the bucket lands in a free slot. Every slot ends up holding exactly one key.
+static void table_build(gen_table* table, gen_key* keys, u32 count) {
+    memset(table, 0, sizeof(*table));
+    if (count == 0)
+        return;
+
+    // Identical hashes can never be separated, so all but the first go to the overflow list
+    qsort(keys, count, sizeof(gen_key), key_compare_hash);
+    gen_key* unique   = (gen_key*)malloc(sizeof(gen_key) * count);
+    table->overflow   = (gen_key*)malloc(sizeof(gen_key) * count);
+    u32 unique_count  = 0;
+    for (u32 i = 0; i < count; i++) {
+        if (unique_count > 0 && unique[unique_count - 1].hash == keys[i].hash)
+            table->overflow[table->overflow_count++] = keys[i];
+        else
+            unique[unique_count++] = keys[i];
+    }
+
+    u32 n             = unique_count;
+    table->count      = n;
+    table->seed_count = (n + 3) / 4;
+    table->seeds      = (u32*)calloc(table->seed_count, sizeof(u32));
+    table->keys       = (gen_key*)malloc(sizeof(gen_key) * n);
+
+    gen_bucket* buckets = (gen_bucket*)calloc(table->seed_count, sizeof(gen_bucket));
+    u32* members        = (u32*)malloc(sizeof(u32) * n);  // Keys ordered by bucket
+    u32* starts         = (u32*)calloc(table->seed_count + 1, sizeof(u32));
+    bool* taken         = (bool*)calloc(n, sizeof(bool));
+    u32* slots          = (u32*)malloc(sizeof(u32) * 4 * n);
+    for (u32 i = 0; i < n; i++) {
+        starts[unique[i].hash % table->seed_count + 1]++;
+    }
+    for (u32 b = 0; b < table->seed_count; b++) {
+        buckets[b].bucket = b;
+        buckets[b].size   = starts[b + 1];
+        starts[b + 1] += starts[b];
+    }
+    u32* fill = (u32*)malloc(sizeof(u32) * table->seed_count);
+    memcpy(fill, starts, sizeof(u32) * table->seed_count);
+    for (u32 i = 0; i < n; i++) {
+        members[fill[unique[i].hash % table->seed_count]++] = i;
+    }
+    qsort(buckets, table->seed_count, sizeof(gen_bucket), bucket_compare_size);
+
+    for (u32 b = 0; b < table->seed_count && buckets[b].size > 0; b++) {
+        u32 bucket = buckets[b].bucket;
+        u32 size   = buckets[b].size;
+        u32 seed   = 0;
+        for (;; seed++) {
+            if (seed == GEN_MAX_SEED)
+                cli_panic("error: no perfect hash found for a bucket of %u keys", size);
+
+            table->seeds[bucket] = seed;
+            bool ok              = true;
+            for (u32 k = 0; k < size && ok; k++) {
+                u32 slot = cli_mph_slot(unique[members[starts[bucket] + k]].hash, table->seeds, table->seed_count, n);
+                ok       = !taken[slot];
+                for (u32 j = 0; j < k && ok; j++) {
+                    ok = slots[j] != slot;
+                }
+                slots[k] = slot;
+            }
+            if (ok)
+                break;
+        }
+
+        for (u32 k = 0; k < size; k++) {
+            taken[slots[k]]       = true;
+            table->keys[slots[k]] = unique[members[starts[bucket] + k]];
+        }
+    }
+
+    free(unique);
+    free(buckets);
+    free(members);
+    free(starts);
+    free(fill);
+    free(taken);
+    free(slots);
+}
+
+static void table_free(gen_table* table) {
+    free(table->keys);
+    free(table->seeds);
+    free(table->overflow);
+}
+
+/*********************************************************************/
+/* Command tree                                                      */
+/*********************************************************************/
+
+// Every command depth first, which is the order the spec lists them in. Indices match gen_spec.actions.
+typedef struct {
+    const cli_command** commands;
+    u32* parents;  // Index of each command's parent, `count` for top-level commands
+    u32* lists;    // Start of each command's children in the emitted command list
+    u32 count;
+} gen_tree;
+
+static void tree_add(gen_tree* tree, cli_command* const* cmds, u32 count, u32 parent) {
+    for (u32 i = 0; i < count; i++) {
+        u32 index             = tree->count++;
+        tree->commands[index] = cmds[i];
+        tree->parents[index]  = parent;
+        tree_add(tree, cmds[i]->children, cmds[i]->child_count, index);
+    }
+}
+
+static void tree_build(gen_tree* tree, const gen_spec* spec) {
+    u32 total      = spec->command_count;
+    tree->commands = (const cli_command**)malloc(sizeof(cli_command*) * (total + 1));
+    tree->parents  = (u32*)malloc(sizeof(u32) * (total + 1));
+    tree->lists    = (u32*)malloc(sizeof(u32) * (total + 1));
+    tree->count    = 0;
+    tree_add(tree, spec->app->commands, spec->app->command_count, total);
+    assert(tree->count == total);
+
+    // The command list holds the top-level commands, then each command's children in turn
+    u32 start = spec->app->command_count;
+    for (u32 i = 0; i < total; i++) {
+        tree->lists[i] = start;
+        start += tree->commands[i]->child_count;
+    }
+}
+
+static void tree_path(const gen_tree* tree, u32 index, command_path* path) {
+    path->depth = 0;
+    for (u32 i = index; i != tree->count; i = tree->parents[i]) {
+        path->depth++;
+    }
+    for (u32 i = index, level = path->depth; i != tree->count; i = tree->parents[i]) {
+        path->items[--level] = tree->commands[i];
+    }
+}
+
+static void tree_free(gen_tree* tree) {
+    free(tree->commands);
+    free(tree->parents);
+    free(tree->lists);
+}
+
+/*********************************************************************/
+/* Output                                                            */
+/*********************************************************************/
+
+// Long strings are split into adjacent literals, one per source line
+static void emit_string(FILE* out, const char* str, size_t len, const char* indent) {
+    fputc('"', out);
+    size_t column = 0;
+    for (size_t i = 0; i < len; i++) {
+        u8 c = (u8)str[i];
+        if (c == '"' || c == '\\')
+            column += (size_t)fprintf(out, "\\%c", c);
+        else if (c == '\n')
+            column += (size_t)fprintf(out, "\\n");
+        else if (c < 0x20 || c >= 0x7f)
+            column += (size_t)fprintf(out, "\\%03o", c);
+        else
+            column += (size_t)fprintf(out, "%c", c);
+
+        if ((c == '\n' || column >= 100) && i + 1 < len) {
+            fprintf(out, "\"\n%s\"", indent);
+            column = 0;
+        }
+    }
+    fputc('"', out);
+}
+
+static void emit_cstr(FILE* out, const char* str) {
+    if (str == NULL)
+        fprintf(out, "NULL");
+    else
+        emit_string(out, str, strlen(str), "      ");
+}
+
+static void emit_help(FILE* out, const cli_help* help) {
+    u32 columns = 0;
+    for (size_t i = 0, start = 0; i <= help->len; i++) {
+        if (i == help->len || help->data[i] == '\n') {
+            columns = gen_max(columns, (u32)(i - start));
+            start   = i + 1;
+        }
+    }
+
+    fprintf(out, "    {");
+    emit_string(out, help->data, help->len, "     ");
+    fprintf(out, ", %zu, %u},\n", help->len, columns);
+}
+
+static void emit_u32s(FILE* out, const char* type, const char* prefix, const char* name, const u32* values, u32 count) {
+    fprintf(out, "static const %s %s_%s[%u] = {", type, prefix, name, gen_max(count, 1));
+    for (u32 i = 0; i < count; i++) {
+        fprintf(out, "%s%uu,", i % 10 == 0 ? "\n    " : " ", values[i]);
+    }
+    fprintf(out, "%s};\n\n", count ? "\n" : "0");
+}
+
+static void emit_keys(FILE* out, const char* prefix, const char* name, const gen_key* keys, u32 count, bool owner) {
+    fprintf(out,
+            "static const struct {\n    u32 name;\n%s    u32 target;\n} %s_%s[%u] = {\n",
+            owner ? "    u32 owner;\n" : "",
+            prefix,
+            name,
+            gen_max(count, 1));
+    for (u32 i = 0; i < count; i++) {
+        if (owner)
+            fprintf(out, "    {%u, %u, %u},\n", keys[i].name, keys[i].owner, keys[i].target);
+        else
+            fprintf(out, "    {%u, %u},\n", keys[i].name, keys[i].target);
+    }
+    if (count == 0)
+        fprintf(out, "    {0},\n");
+    fprintf(out, "};\n\n");
+}
+
+// A lookup function over one table, keyed by name and owner: the parent command, or the command an option belongs
+// to. `global` is the owner of top-level commands and global options. Parts that can never match are left out.
+static void emit_find(FILE* out, const char* prefix, const char* kind, const char* param, const gen_table* table,
+                      u32 global) {
+    char name[64];
+    if (table->count > 0) {
+        snprintf(name, sizeof(name), "%s_seeds", kind);
+        emit_u32s(out, "u32", prefix, name, table->seeds, table->seed_count);
+        snprintf(name, sizeof(name), "%s_table", kind);
+        emit_keys(out, prefix, name, table->keys, table->count, true);
+    }
+    if (table->overflow_count > 0) {
+        snprintf(name, sizeof(name), "%s_overflow", kind);
+        emit_keys(out, prefix, name, table->overflow, table->overflow_count, true);
+    }
+
+    fprintf(out,
+            "static const cli_%2$s* %1$s_find_%2$s(const cli_command* %3$s, const char* str, size_t len, u32 hash) {\n",
+            prefix,
+            kind,
+            param);
+    if (table->count == 0) {
+        fprintf(out, "    (void)%s;\n    (void)str;\n    (void)len;\n    (void)hash;\n    return NULL;\n}\n\n", param);
+        return;
+    }
+
+    fprintf(out,
+            "    u32 owner = %3$s ? (u32)(%3$s - %1$s_commands) : %4$uu;\n"
+            "    u32 slot  = cli_mph_slot(hash ^ (owner + 1) * 0x%5$08xu, %1$s_%2$s_seeds, %6$u, %7$u);\n"
+            "    if (%1$s_%2$s_table[slot].owner == owner &&\n"
+            "        cli_name_equals(&%1$s_names[%1$s_%2$s_table[slot].name], str, len, hash))\n"
+            "        return &%1$s_%2$ss[%1$s_%2$s_table[slot].target];\n",
+            prefix,
+            kind,
+            param,
+            global,
+            GEN_OWNER_SALT,
+            gen_max(table->seed_count, 1),
+            table->count);
+    if (table->overflow_count > 0) {
+        fprintf(out,
+                "    for (u32 i = 0; i < %3$u; i++) {\n"
+                "        if (%1$s_%2$s_overflow[i].owner == owner &&\n"
+                "            cli_name_equals(&%1$s_names[%1$s_%2$s_overflow[i].name], str, len, hash))\n"
+                "            return &%1$s_%2$ss[%1$s_%2$s_overflow[i].target];\n"
+                "    }\n",
+                prefix,
+                kind,
+                table->overflow_count);
+    }
+    fprintf(out, "    return NULL;\n}\n\n");
+}
+
+// Required or sourced option bitsets, copied from the frozen app: each covers a command's own and inherited options.
+// Returns where each command's bits start.
+static u32* emit_option_bits(FILE* out, const gen_tree* tree, const char* prefix, const char* field) {
+    u32* offsets   = (u32*)malloc(sizeof(u32) * (tree->count + 1));
+    u32 word_count = 0;
+    bool required  = strcmp(field, "required") == 0;
+    fprintf(out, "static const u64 %s_%s[] = {", prefix, field);
+    for (u32 i = 0; i < tree->count; i++) {
+        command_path path;
+        u32 accepted = 0;
+        tree_path(tree, i, &path);
+        for (u32 level = 0; level < path.depth; level++) {
+            accepted += path.items[level]->option_count;
+        }
+
+        const u64* bits = required ? tree->commands[i]->required : tree->commands[i]->sourced;
+        offsets[i]      = word_count;
+        for (u32 w = 0; w < (accepted + 63) / 64; w++, word_count++) {
+            fprintf(out, "%s0x%016llxull,", word_count % 4 == 0 ? "\n    " : " ", (unsigned long long)bits[w]);
+        }
+    }
+    fprintf(out, "%s};\n\n", word_count ? "\n" : "0");
+    return offsets;
+}
+
+static void emit_header(FILE* out, const gen_spec* spec, const gen_tree* tree, const char* prefix, const char* source) {
+    cli_app* app = spec->app;
+
+    char guard[256];
+    snprintf(guard, sizeof(guard), "%s_CLI_H", prefix);
+    for (char* c = guard; *c; c++) {
+        if (*c >= 'a' && *c <= 'z')
+            *c = (char)(*c - 'a' + 'A');
+    }
+
+    fprintf(out, "// Generated by clic-gen from %s. Do not edit.\n\n#ifndef %s\n#define %s\n\n", source, guard, guard);
+
+    // Names: every command's, then every option's in emitted order
+    u32 name_count = 0;
+    for (u32 i = 0; i < tree->count; i++) {
+        name_count += tree->commands[i]->name_count;
+    }
+    for (u32 i = 0; i < app->option_count; i++) {
+        name_count += app->options[i].name_count;
+    }
+
+    u32* command_names = (u32*)malloc(sizeof(u32) * (tree->count + 1));
+    u32* option_names  = (u32*)malloc(sizeof(u32) * (app->option_count + 1));
+    gen_key* command_keys = (gen_key*)malloc(sizeof(gen_key) * (name_count + 1));
+    gen_key* option_keys  = (gen_key*)malloc(sizeof(gen_key) * (name_count + 1));
+    u32 command_key_count = 0, option_key_count = 0;
+
+    // Frozen options are the global ones, then each command's in turn
+    u32* owners = (u32*)malloc(sizeof(u32) * (app->option_count + 1));
+    for (u32 i = 0; i < app->global_option_count; i++) {
+        owners[i] = tree->count;
+    }
+    for (u32 c = 0; c < tree->count; c++) {
+        const cli_command* cmd = tree->commands[c];
+        for (u32 i = 0; i < cmd->option_count; i++) {
+            owners[cmd->options - app->options + i] = c;
+        }
+    }
+
+    fprintf(out, "static const cli_name %s_names[%u] = {\n", prefix, gen_max(name_count, 1));
+    u32 name = 0;
+    for (u32 i = 0; i < tree->count; i++) {
+        const cli_command* cmd    = tree->commands[i];
+        u32 owner                 = tree->parents[i];
+        const cli_command* parent = owner < tree->count ? tree->commands[owner] : NULL;
+
+        command_names[i] = name;
+        for (u32 n = 0; n < cmd->name_count; n++, name++) {
+            const cli_name* nm = &cmd->name_list[n];
+            fprintf(out, "    {");
+            emit_string(out, nm->str, nm->len, "");
+            fprintf(out, ", %u, 0x%08xu},\n", nm->len, nm->hash);
+
+            // A name registered twice belongs to whichever the runtime finds, the first one
+            if (find_command(app, parent, nm->str, nm->len) == cmd)
+                command_keys[command_key_count++] = (gen_key){gen_owner_hash(nm->hash, owner), name, owner, i};
+        }
+    }
+    for (u32 i = 0; i < app->option_count; i++) {
+        const cli_option* opt  = &app->options[i];
+        const cli_command* cmd = opt->command;
+        u32 owner              = owners[i];
+
+        option_names[i] = name;
+        for (u32 n = 0; n < opt->name_count; n++, name++) {
+            const cli_name* nm = &opt->name_list[n];
+            fprintf(out, "    {");
+            emit_string(out, nm->str, nm->len, "");
+            fprintf(out, ", %u, 0x%08xu},\n", nm->len, nm->hash);
+
+            if (find_option_hashed(app, cmd, nm->str, nm->len, nm->hash) == opt)
+                option_keys[option_key_count++] = (gen_key){gen_owner_hash(nm->hash, owner), name, owner, i};
+        }
+    }
+    if (name_count == 0)
+        fprintf(out, "    {\"\", 0, 0},\n");
+    fprintf(out, "};\n\n");
+
+    // Options, contiguous per command as in a frozen app
+    fprintf(out, "static const cli_option %s_options[%u] = {\n", prefix, gen_max(app->option_count, 1));
+    for (u32 i = 0; i < app->option_count; i++) {
+        const cli_option* opt = &app->options[i];
+        fprintf(out, "    {.name_list = %s_names + %u, .name_count = %u, .required = %s, .is_flag = %s,\n", prefix,
+                option_names[i], opt->name_count, opt->required ? "true" : "false", opt->is_flag ? "true" : "false");
+        fprintf(out, "     .names = ");
+        emit_cstr(out, opt->names);
+        fprintf(out, ",\n     .help_text = ");
+        emit_cstr(out, opt->help_text);
+        if (opt->type != CLI_TYPE_STRING || opt->min != opt->max)
+            fprintf(out, ",\n     .type = %u, .min = %ld, .max = %ld", opt->type, opt->min, opt->max);
+        if (opt->choice_count > 0) {
+            fprintf(out, ",\n     .choices = (const char* const[]){");
+            for (u32 c = 0; c < opt->choice_count; c++) {
+                fputs(c ? ", " : "", out);
+                emit_cstr(out, opt->choices[c]);
+            }
+            fprintf(out, "}, .choice_count = %u", opt->choice_count);
+        }
+        if (opt->env != NULL) {
+            fprintf(out, ",\n     .env = ");
+            emit_cstr(out, opt->env);
+        }
+        if (opt->config_key != NULL) {
+            fprintf(out, ",\n     .config_key = ");
+            emit_cstr(out, opt->config_key);
+        }
+        fprintf(out, "},\n");
+    }
+    if (app->option_count == 0)
+        fprintf(out, "    {0},\n");
+    fprintf(out, "};\n\n");
+
+    // Help, laid out by the runtime with wrapping off: the app's first, then one per command
+    help_cached_width = 0;
+    fprintf(out, "static const cli_help %s_help[%u] = {\n", prefix, tree->count + 1);
+    emit_help(out, app_help(app));
+    for (u32 i = 0; i < tree->count; i++) {
+        command_path path;
+        tree_path(tree, i, &path);
+        emit_help(out, command_help(app, &path));
+    }
+    fprintf(out, "};\n\n");
+
+    u32* required = emit_option_bits(out, tree, prefix, "required");
+    u32* sourced  = emit_option_bits(out, tree, prefix, "sourced");
+
+    // Every command, and a list of pointers to them: the top-level commands, then each command's children. Action
+    // prototypes are left to the includer, who knows their linkage.
+    u32 list_count = tree->count;
+    if (tree->count > 0)
+        fprintf(out, "static cli_help* %s_help_slots[%u];\n", prefix, tree->count);
+    fprintf(out, "static const cli_command* const %s_command_list[%u];\n\n", prefix, gen_max(list_count, 1));
+    fprintf(out, "static const cli_command %s_commands[%u] = {\n", prefix, gen_max(tree->count, 1));
+    for (u32 i = 0; i < tree->count; i++) {
+        const cli_command* cmd = tree->commands[i];
+        const char* action     = strcmp(spec->actions[i], "-") != 0 ? spec->actions[i] : "NULL";
+        fprintf(out, "    {.names = ");
+        emit_cstr(out, cmd->names);
+        fprintf(out, ",\n     .%s = %s,\n     .help_text = ", cmd->action_ex ? "action_ex" : "action", action);
+        emit_cstr(out, cmd->help_text);
+        fprintf(out,
+                ",\n     .name_list = %s_names + %u, .name_count = %u,\n"
+                "     .options = %s_options + %u, .option_count = %u,\n"
+                "     .help = &%s_help_slots[%u], .layout = &%s_help[%u], .required = %s_required + %u,\n"
+                "     .sourced = %s_sourced + %u, .inherited_option_count = %u",
+                prefix,
+                command_names[i],
+                cmd->name_count,
+                prefix,
+                (u32)(cmd->options - app->options),
+                cmd->option_count,
+                prefix,
+                i,
+                prefix,
+                i + 1,
+                prefix,
+                required[i],
+                prefix,
+                sourced[i],
+                cmd->inherited_option_count);
+        if (cmd->child_count > 0)
+            fprintf(out, ",\n     .children = (cli_command**)(%s_command_list + %u), .child_count = %u",
+                    prefix, tree->lists[i], cmd->child_count);
+        fprintf(out, "},\n");
+    }
+    if (tree->count == 0)
+        fprintf(out, "    {0},\n");
+    fprintf(out, "};\n\n");
+
+    // Children come in spec order, so each one is simply the next of its parent's block
+    u32* list = (u32*)malloc(sizeof(u32) * (list_count + 1));
+    u32* fill = (u32*)calloc(tree->count + 1, sizeof(u32));
+    for (u32 i = 0; i < tree->count; i++) {
+        u32 parent = tree->parents[i];
+        u32 start  = parent < tree->count ? tree->lists[parent] : 0;
+        list[start + fill[parent]++] = i;
+    }
+    fprintf(out, "static const cli_command* const %s_command_list[%u] = {\n", prefix, gen_max(list_count, 1));
+    for (u32 i = 0; i < list_count; i++) {
+        fprintf(out, "    &%s_commands[%u],\n", prefix, list[i]);
+    }
+    free(list);
+    free(fill);
+    if (tree->count == 0)
+        fprintf(out, "    NULL,\n");
+    fprintf(out, "};\n\n");
+
+    // Lookup tables and functions
+    gen_table commands, options;
+    table_build(&commands, command_keys, command_key_count);
+    table_build(&options, option_keys, option_key_count);
+
+    emit_find(out, prefix, "command", "parent", &commands, tree->count);
+    emit_find(out, prefix, "option", "cmd", &options, tree->count);
+
+    fprintf(out,
+            "static const cli_app_lookup %1$s_lookup = {%1$s_find_command, %1$s_find_option, &%1$s_help[0], %2$s};\n\n",
+            prefix,
+            app->batch_enabled ? "true" : "false");
+
+    fprintf(out, "static const cli_app_def %s_def = {\n    .name = ", prefix);
+    emit_cstr(out, app->name);
+    fprintf(out, ",\n    .version = ");
+    emit_cstr(out, app->version);
+    fprintf(out, ",\n    .description = ");
+    emit_cstr(out, app->description);
+    if (spec->default_action != NULL)
+        fprintf(out, ",\n    .default_action = &(cli_action){%s}", spec->default_action);
+    fprintf(out,
+            ",\n    .commands = %1$s_command_list,\n    .command_count = %2$u,\n"
+            "    .options = %1$s_options,\n    .option_count = %3$u,\n"
+            "    .batch_enabled = %4$s,\n    .lookup = &%1$s_lookup,\n};\n\n#endif\n",
+            prefix, app->command_count, app->global_option_count, app->batch_enabled ? "true" : "false");
+
+    table_free(&commands);
+    table_free(&options);
+    free(command_names);
+    free(option_names);
+    free(required);
+    free(sourced);
+    free(owners);
+    free(command_keys);
+    free(option_keys);
+}
+
+// The first names of the commands above `index`, each followed by a space
+static void emit_parent_path(FILE* out, const gen_tree* tree, u32 index) {
+    command_path path;
+    tree_path(tree, index, &path);
+    for (u32 level = 0; level + 1 < path.depth; level++) {
+        const cli_name* name = &path.items[level]->name_list[0];
+        fprintf(out, "%.*s ", (int)name->len, name->str);
+    }
+}
+
+// One `--batch` line per name: each reaches the lookup and stops with help or an error before any action runs
+static void emit_cases(FILE* out, const gen_tree* tree) {
+    fprintf(out, "--help\n-h\n--version\nclic-gen-unknown\n");
+    for (u32 i = 0; i < tree->count; i++) {
+        const cli_command* cmd = tree->commands[i];
+        for (u32 n = 0; n < cmd->name_count; n++) {
+            const cli_name* name = &cmd->name_list[n];
+            const char* suffixes[] = {" --help", " -h", " --clic-gen-unknown", " clic-gen-unknown", ""};
+            u32 suffix_count       = cmd->child_count == 0 ? 3 : cmd->action || cmd->action_ex ? 4 : 5;
+            for (u32 k = 0; k < suffix_count; k++) {
+                emit_parent_path(out, tree, i);
+                fprintf(out, "%.*s%s\n", (int)name->len, name->str, suffixes[k]);
+            }
+        }
+
+        // Flags are followed by an unknown option, values are left without one. Inherited options are included.
+        const cli_name* cmd_name = &cmd->name_list[0];
+        command_path path;
+        tree_path(tree, i, &path);
+        for (u32 level = 0; level < path.depth; level++) {
+            const cli_command* owner = path.items[level];
+            for (u32 o = 0; o < owner->option_count; o++) {
+                const cli_option* opt = &owner->options[o];
+                for (u32 n = 0; n < opt->name_count; n++) {
+                    emit_parent_path(out, tree, i);
+                    fprintf(out, "%.*s %.*s%s\n", (int)cmd_name->len, cmd_name->str, (int)opt->name_list[n].len,
+                            opt->name_list[n].str, opt->is_flag ? " --clic-gen-unknown" : "");
+                }
+            }
+        }
+    }
+}
+
+/*********************************************************************/
+/* Entry point                                                       */
+/*********************************************************************/
+
+static noreturn void usage(void) {
+    fprintf(stderr, "usage: clic-gen [-p prefix] [-o header] [-c cases] (spec | --from program)\n");
+    exit(2);
+}
+
+int main(int argc, char* argv[]) {
+    const char *prefix = NULL, *output = NULL, *cases = NULL, *spec_path = NULL, *program = NULL;
+    for (i32 i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (i + 1 < argc && strcmp(arg, "-p") == 0)
+            prefix = argv[++i];
+        else if (i + 1 < argc && strcmp(arg, "-o") == 0)
+            output = argv[++i];
+        else if (i + 1 < argc && strcmp(arg, "-c") == 0)
+            cases = argv[++i];
+        else if (i + 1 < argc && strcmp(arg, "--from") == 0)
+            program = argv[++i];
+        else if (arg[0] != '-' && spec_path == NULL)
+            spec_path = arg;
+        else
+            usage();
+    }
+    if ((spec_path == NULL) == (program == NULL))
+        usage();
+
+    char* text;
+    if (program != NULL) {
+        text = read_dump(program);
+    } else {
+        int fd = open(spec_path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            fprintf(stderr, "error: failed to open %s: %s\n", spec_path, strerror(errno));
+            return 1;
+        }
+        text = read_all(fd, spec_path);
+        close(fd);
+    }
+
+    gen_spec spec = {0};
+    spec_parse(&spec, text);
+    cli_app_freeze(spec.app);
+
+    gen_tree tree;
+    tree_build(&tree, &spec);
+
+    // The prefix defaults to the app name, made into an identifier
+    char default_prefix[128];
+    if (prefix == NULL) {
+        snprintf(default_prefix, sizeof(default_prefix), "%s", spec.app->name);
+        for (char* c = default_prefix; *c; c++) {
+            bool ident = (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9');
+            if (!ident)
+                *c = '_';
+        }
+        prefix = default_prefix;
+    }
+
+    FILE* out = output ? fopen(output, "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "error: failed to open %s: %s\n", output, strerror(errno));
+        return 1;
+    }
+    emit_header(out, &spec, &tree, prefix, program ? program : spec_path);
+    if (out != stdout && fclose(out) != 0) {
+        fprintf(stderr, "error: failed to write %s: %s\n", output, strerror(errno));
+        return 1;
+    }
+
+    if (cases != NULL) {
+        FILE* file = fopen(cases, "w");
+        if (file == NULL) {
+            fprintf(stderr, "error: failed to open %s: %s\n", cases, strerror(errno));
+            return 1;
+        }
+        emit_cases(file, &tree);
+        fclose(file);
+    }
+
+    tree_free(&tree);
+    cli_app_destroy(spec.app);
+    free(spec.actions);
+    free(text);
+    return 0;
+}